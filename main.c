@@ -23,7 +23,7 @@
 //         --|RST          XOUT|-
 //           |                 |
 //           |   CCI0B/TXD/P1.1|-------->
-//           |                 | 9600 8N1
+//           |                 | UART_BAUD 8N1
 //           |   CCI0A/RXD/P1.2|<--------
 //
 //  D. Dang
@@ -40,36 +40,879 @@
 #define UART_TXD   BIT1                     // TXD on P1.1 (Timer0_A.OUT0)
 #define UART_RXD   BIT2                     // RXD on P1.2 (Timer0_A.CCI1A)
 //----------------------adding
+// Define SHIFT_USE_USI to clock the 74HC595 chain with the USI in SPI mode
+// instead of bit-banging it. The USI's SDO and SCLK are fixed to P1.6 and
+// P1.5, so DATA and CLOCK move there and OE moves from P1.5 to P1.0:
+//
+//               bit-bang    USI
+//      DATA     P1.0        P1.6 (SDO)
+//      CLOCK    P1.3        P1.5 (SCLK)
+//      LATCH    P1.4        P1.4
+//      ENABLE   P1.5        P1.0
+//
+//#define SHIFT_USE_USI
+#ifdef SHIFT_USE_USI
+#define DATA BIT6 // SDO -> 1.6
+#define CLOCK BIT5 // SCLK -> 1.5
+#define LATCH BIT4 // ST_CP -> 1.4
+#define ENABLE BIT0 // OE -> 1.0
+#else
 #define DATA BIT0 // Data -> 1.0
 #define CLOCK BIT3 // SH_CP -> 1.3
 #define LATCH BIT4 // ST_CP -> 1.4
 #define ENABLE BIT5 // OE -> 1.5
-#define ROW0 0x01 // ROW 1.4
-#define ROW1 0x02 // ROW 1.5
-#define ROW2 0x03 // ROW 1.6
+#endif
+#define ROW0 0x01 // ROW A -> 2.0
+#define ROW1 0x02 // ROW B -> 2.1
+#define ROW2 0x04 // ROW C -> 2.2
+#define ROW_MASK (ROW0 + ROW1 + ROW2)
+#define ROWS 8 // Rows scanned by the refresh engine
 //----------------------
 
 //------------------------------------------------------------------------------
-// Conditions for 9600 Baud SW UART, SMCLK = 1MHz
+// Clock selection. MCLK = SMCLK = DCO at SMCLK_FREQ. The G2231 is factory
+// calibrated for 1 MHz only (CALBC1_1MHZ/CALDCO_1MHZ in segment A). For 8 or
+// 16 MHz define DCO_BCSCTL1 and DCO_DCOCTL with the register values for
+// that frequency measured on the chip itself, for instance with TI's DCO
+// calibration example against a 32768 Hz crystal; the DCO spreads too much
+// between parts for fixed values. Parts whose header has the 8 and 16 MHz
+// constants (CALBC1_8MHZ_, as on the G2x53) use them when these are not
+// defined.
+//------------------------------------------------------------------------------
+#ifndef SMCLK_FREQ
+#define SMCLK_FREQ              1000000
+#endif
+//#define DCO_BCSCTL1             0x8D        // Example only, measure yours
+//#define DCO_DCOCTL              0x92
+
+#if SMCLK_FREQ != 1000000 && SMCLK_FREQ != 8000000 && SMCLK_FREQ != 16000000
+#error "SMCLK_FREQ must be 1, 8 or 16 MHz"
+#endif
+
+#if defined(DCO_BCSCTL1) && defined(DCO_DCOCTL)
+#define DCO_CALBC1              DCO_BCSCTL1
+#define DCO_CALDCO              DCO_DCOCTL
+#elif SMCLK_FREQ == 1000000
+#define DCO_CALBC1              CALBC1_1MHZ
+#define DCO_CALDCO              CALDCO_1MHZ
+#elif SMCLK_FREQ == 8000000 && defined(CALBC1_8MHZ_)
+#define DCO_CALBC1              CALBC1_8MHZ
+#define DCO_CALDCO              CALDCO_8MHZ
+#elif SMCLK_FREQ == 16000000 && defined(CALBC1_16MHZ_)
+#define DCO_CALBC1              CALBC1_16MHZ
+#define DCO_CALDCO              CALDCO_16MHZ
+#else
+#error "No DCO calibration for SMCLK_FREQ on this part, define DCO_BCSCTL1/DCO_DCOCTL"
+#endif
+
+//------------------------------------------------------------------------------
+// Low-power mode. Define DISPLAY_LPM3 to run the row scan from ACLK (32768 Hz
+// watch crystal on XIN/XOUT) and idle in LPM3, with the DCO and SMCLK off.
+// Whenever the UART is sending or inside a received character the main loop
+// idles in LPM0 instead, so Timer_A keeps its SMCLK. A start bit arriving
+// during LPM3 is captured asynchronously while TAR stands still; the timer
+// resumes with the DCO (~1.5 us), which shifts the sample points by that
+// much (0.7% of a bit at 4800 baud, 1 MHz). The UART ISRs may run nested
+// inside WDT_ISR, where their start bit and wake-up changes to the SR only
+// reach WDT_ISR's copy, so WDT_ISR wakes the main loop on every tick and it
+// picks LPM3 or LPM0 again.
+//
+// Energy model at 1 MHz, 3 V, MCU only (LEDs not included). A WDT_ISR row
+// costs ~350 cycles bit-banged and ~110 with SHIFT_USE_USI, the frame gap
+// with a scrolling marquee ~800 and ~550 (a blank row shift included), and
+// the main loop ~40 per tick to go back
+// to sleep; the datasheet gives ~300 uA active, ~55 uA in LPM0 and ~0.9 uA
+// in LPM3 with LFXT1:
+//
+//                        rows/s  active cycles/s   sleep      average
+//   LPM0, SMCLK scan     1562    ~704000 (70%)     LPM0       ~225 uA
+//   LPM3, bit-bang       455     ~226000 (23%)     LPM3       ~69 uA
+//   LPM3, USI            455     ~102000 (10%)     LPM3       ~32 uA
+//
+// Each received character adds ~10 bit times in LPM0 plus ~250 active
+// cycles. The refresh drops to 57 Hz, so MARQUEE_TICKS and animation
+// periods count 17.6 ms task ticks.
+//------------------------------------------------------------------------------
+//#define DISPLAY_LPM3
+
+//------------------------------------------------------------------------------
+// Shift register chain. PANELS 8x16 panels are daisy-chained on DATA/CLOCK
+// and share LATCH and OE, so a row is CHAIN_BYTES bytes clocked out back to
+// back before one latch. A row is ROW_WORDS words in the page, 16 columns
+// each, column 0 (bit 0 of word 0) at the left. The first bits shifted travel
+// furthest, so the panel next to the MCU shows the rightmost 16 columns.
+//
+// A row has to be shifted within one scan tick, which is 512 cycles at every
+// SMCLK_FREQ. Bit-banged, a panel's row takes ~300 cycles, so a bit-banged
+// chain is one panel; two panels need 660. Longer chains need SHIFT_USE_USI
+// (~40 cycles a panel) or DISPLAY_LPM3, whose ACLK tick is 1953 cycles at
+// 1 MHz.
+//------------------------------------------------------------------------------
+#ifndef PANELS
+#define PANELS                  1
+#endif
+#define ROW_WORDS               PANELS
+#define CHAIN_BYTES             (ROW_WORDS * 2)
+
+//------------------------------------------------------------------------------
+// Grayscale by binary code modulation. A page holds DISPLAY_PLANES bit planes
+// of ROWS rows, most significant plane first; plane 0 is what all on/off
+// drawing (text, marquee, animations) uses. WDT_ISR shows each row's planes
+// in turn and keeps plane p lit for its weight, 2^(DISPLAY_PLANES - 1 - p)
+// ticks, so a pixel gets 2^DISPLAY_PLANES levels for one shift per plane.
+//
+// Ticks, refresh rate and WDT_ISR CPU load at 1 MHz, 512 us ticks, ~350
+// cycles per shifting tick (bit-bang), ~20 per holding tick and ~800 over
+// two ticks for the frame gap:
+//
+//      planes  levels  ticks/row  refresh   CPU
+//      1       2       1          195 Hz    70%
+//      2       4       3          75 Hz     50%
+//      3       8       7          34 Hz     34%
+//
+// 8 levels flicker at 1 MHz. At 8 and 16 MHz the ticks are 8 or 16 times
+// shorter for the same CPU share, 269 or 539 Hz with 8 levels. Grayscale
+// needs the SMCLK scan; DISPLAY_LPM3 refreshes too slowly.
+//
+// RAM is the other limit: with more than one plane or panel there is a
+// single page, drawn while it is shown, so updates can tear for one frame,
+// and frame or store packets land on the display even when they are NAKed.
+// On/off content lights plane 0 only and so shows at 2/3 (4 levels) or 4/7
+// (8 levels) of full brightness. A page takes 16 bytes per panel and plane,
+// and the G2231 has room for 32 bytes of pages (see the RAM table below):
+// one on/off panel with two pages, or one page for two on/off panels (with
+// SHIFT_USE_USI, see above) or for one panel with 4 levels. A single page
+// also leaves no room to receive text into, and the measured stack does not
+// fit next to a separate text buffer: the single-page builds need a part
+// with more RAM, as do 8 levels, three panels or two panels with grayscale.
+//------------------------------------------------------------------------------
+#ifndef DISPLAY_PLANES
+#define DISPLAY_PLANES          1           // 1 (on/off), 2 or 3
+#endif
+#define PAGE_WORDS              (DISPLAY_PLANES * ROWS * ROW_WORDS)
+#if PAGE_WORDS > ROWS
+#define DISPLAY_PAGES           1           // No RAM for a second page
+#else
+#define DISPLAY_PAGES           2
+#endif
+
+//------------------------------------------------------------------------------
+// Display refresh. Timer_A CCR0 and CCR1 both belong to the UART, so the row
+// scan runs from the watchdog timer in interval mode, one row per tick:
+// SMCLK / 512 (512 us per row at 1 MHz, 64 and 32 us at 8 and 16 MHz), the
+// same 512 cycles at every clock so the brightness counter below sees the
+// same tick. With DISPLAY_LPM3 it is ACLK / 64 (1.95 ms per row). After the
+// last row the display stays dark for DISPLAY_GAP_TICKS ticks while the main
+// loop flips pages and runs the frame scheduler below, so that work never
+// delays a row: 10 ticks, 5.1 ms or 195 Hz per frame at 1 MHz (1562 and 3125
+// Hz at 8 and 16 MHz), 9 ticks, 17.6 ms or 57 Hz with DISPLAY_LPM3.
+//------------------------------------------------------------------------------
+#if defined(DISPLAY_LPM3)
+#define DISPLAY_WDT_INTERVAL    WDT_ADLY_1_9
+#define DISPLAY_TICK_US         1953UL
+#else
+#define DISPLAY_WDT_INTERVAL    WDT_MDLY_0_5
+#define DISPLAY_TICK_US         (512000UL / (SMCLK_FREQ / 1000))
+#endif
+#define DISPLAY_TICK_CYCLES     (DISPLAY_TICK_US * (SMCLK_FREQ / 1000000UL))
+#define COLS                    (16 * ROW_WORDS)    // Bit 0 of word 0 = left
+
+// WDT_ISR cycles for a row tick (setRows()) and for the first gap tick (a
+// blank row shift, then the main loop's scheduler with every task due at
+// once, marqueeStep() being the longest), counted from the MSP430
+// instruction timings. A row tick has to fit in one tick, or every row after
+// it starts late and is lit for less; the gap gets as many dark ticks as its
+// work needs. A packet's work (a page flip, text, a flash write) may take
+// longer and then stretches that one frame's gap. Each row stays lit from
+// its latch to the next tick's blanking after the next shift, and the gap
+// shifts a blank row before it blanks so the last row and plane get the
+// same on-time. (Latching first and shifting the next row after it would
+// save the shift, but in the USI build rowEnable()'s on-time count clocks
+// the '595 and would corrupt the pre-shifted row.) UART ISRs preempting
+// WDT_ISR come on top: during a packet at 4800 baud and 1 MHz they take
+// almost half the CPU, and rows run late while it lasts.
+#ifdef SHIFT_USE_USI
+#define SHIFT_WORD_CYCLES       40          // shiftData(), one USI transfer
+#else
+#define SHIFT_WORD_CYCLES       300         // Two unrolled shiftByte() calls
+#endif
+#define WDT_ISR_ROW_CYCLES      (SHIFT_WORD_CYCLES * ROW_WORDS + 60)
+#define WDT_ISR_GAP_CYCLES      (WDT_ISR_ROW_CYCLES + 150 + (17 + 20 * ROW_WORDS) * ROWS)
+
+#if WDT_ISR_ROW_CYCLES > DISPLAY_TICK_CYCLES
+#error "Row shift is longer than a scan tick, a bit-banged chain is one panel: use SHIFT_USE_USI"
+#endif
+
+#define DISPLAY_GAP_TICKS       ((WDT_ISR_GAP_CYCLES + DISPLAY_TICK_CYCLES - 1) \
+                                 / DISPLAY_TICK_CYCLES)
+#define DISPLAY_FRAME_TICKS     (ROWS * ((1 << DISPLAY_PLANES) - 1) + DISPLAY_GAP_TICKS)
+#define DISPLAY_FRAME_US        (DISPLAY_TICK_US * DISPLAY_FRAME_TICKS)
+
+//------------------------------------------------------------------------------
+// Frame scheduler. WDT_ISR posts EV_TASKS every TASK_FRAMES refresh frames,
+// in the frame gap, and taskSchedule() runs task i when taskCount[i] counts
+// down to zero; a count of 0 leaves it idle. Each task returns the task
+// ticks until its next run, or 0 to stop. TASK_FRAMES keeps the task tick at
+// the 1 MHz frame time (5.1 ms with one plane) when the faster clocks
+// refresh 8 or 16 times as often. Tasks must be short.
+//------------------------------------------------------------------------------
+#ifdef DISPLAY_LPM3
+#define TASK_FRAMES             1
+#else
+#define TASK_FRAMES             (SMCLK_FREQ / 1000000)
+#endif
+#define TASK_TICK_US            (DISPLAY_FRAME_US * TASK_FRAMES)
+
+#define TASK_MARQUEE            0           // marqueeStep()
+#define TASK_ANIM               1           // animStep()
+#define TASK_PROTO              2           // protoTimeout()
+#ifdef TELEMETRY_MS
+#define TASK_TELEMETRY          3           // telemetryTick()
+#define TASKS                   4
+#else
+#define TASKS                   3
+#endif
+
+//------------------------------------------------------------------------------
+// Main loop events. WDT_ISR and frame tasks post 1 << EV_x in events;
+// Timer_A1_ISR sets protoReady for EV_PACKET instead, which keeps its last
+// bit inside its cycle budget. Events only run in the frame gap: WDT_ISR's
+// first gap tick finds them pending, leaves its own interrupt off and wakes
+// the main loop, which runs the lowest numbered pending event first,
+// re-checks after each, and turns the scan back on once none is left before
+// it sleeps as deep as the UART allows. The scan never preempts main loop
+// work, so neither WDT_ISR nor a task nests on top of it (see the RAM table).
+//
+// Wakeup-to-dispatch latency for EV_PACKET, from the last RX bit's compare
+// event to protoExecute(), is the wait for the next frame gap: at most a
+// frame and the gap tick's own work. The host test measures it for each
+// build it runs and prints the range (testLatency() in test/test_main.c);
+// on the device, TELEMETRY_MS keeps the worst case seen in eventLatencyMax
+// (SMCLK cycles) and every status packet reports it.
+//------------------------------------------------------------------------------
+#define EV_PACKET               0           // protoExecute()
+#define EV_TASKS                1           // taskSchedule()
+#ifdef TELEMETRY_MS
+#define EV_TELEMETRY            2           // telemetrySend()
+#define EVENTS                  3
+#else
+#define EVENTS                  2
+#endif
+
+//------------------------------------------------------------------------------
+// Telemetry. Define TELEMETRY_MS to have the device send a status packet
+//
+//      PROTO_SYNC | PROTO_CMD_STATUS | 4 | rxOverflow | eventLatencyMax | crc
+//
+// (little-endian words) at that interval. Hosts tell it from an answer by
+// its first byte. It needs SMCLK_FREQ of 8 MHz (see the ISR budget).
+//------------------------------------------------------------------------------
+//#define TELEMETRY_MS            1000
+
+//------------------------------------------------------------------------------
+// 5x7 font, 0x20 (space) to 0x5F ('_'). Lower case is folded to upper case.
+//------------------------------------------------------------------------------
+#define FONT_FIRST              0x20
+#define FONT_LAST               0x5F
+#define FONT_WIDTH              5
+#define FONT_HEIGHT             7
+#define FONT_ADVANCE            (FONT_WIDTH + 1)
+
+//------------------------------------------------------------------------------
+// Scrolling text. Text too long for the display scrolls right to left, one
+// column every MARQUEE_TICKS task ticks (14 x 5.1 ms = 72 ms, ~14 columns/s
+// by default).
+//------------------------------------------------------------------------------
+#define TEXT_SIZE               16          // Text buffer incl. terminator
+#ifdef DISPLAY_LPM3
+#define MARQUEE_TICKS           4           // Same speed at the 57 Hz refresh
+#else
+#define MARQUEE_TICKS           14
+#endif
+#define BRIGHTNESS_MAX          15          // Levels 0 (dark) to 15 (full)
+
+#if DISPLAY_PAGES > 1 && TEXT_SIZE > PAGE_WORDS * 2
+#error "TEXT_SIZE does not fit in the back page"
+#endif
+
+//------------------------------------------------------------------------------
+// Brightness. Below BRIGHTNESS_MAX each row is blanked through OE after
+// oeCount[displayBrightness] counts of the USI counter, started when the row
+// is latched and stopped before the next latch, so a row is never cut short
+// or lit past its own tick. The USI clock is picked so 32 counts make one
+// tick: level n is n/16 on-time. LED current drops with it. A grayscale
+// plane held for several ticks gets one count per tick back to back, not a
+// count restarted on each held tick while the last one still runs. In the
+// USI build the next shiftData() takes the counter back at the start of the
+// next shifting tick, so there the levels divide the tick less the row shift
+// before the latch; a longer count would be cut off there and leave the row
+// lit to the next blanking, brighter than the level above it.
+//------------------------------------------------------------------------------
+#if defined(DISPLAY_LPM3)
+#define OE_USICKCTL             (USIDIV_1 + USISSEL_1)  // ACLK / 2
+#else
+#define OE_USICKCTL             (USIDIV_4 + USISSEL_2)  // SMCLK / 16
+#endif
+#ifdef SHIFT_USE_USI
+#define OE_WINDOW_CYCLES        (DISPLAY_TICK_CYCLES - WDT_ISR_ROW_CYCLES)
+#else
+#define OE_WINDOW_CYCLES        DISPLAY_TICK_CYCLES
+#endif
+#define OE_COUNT(n)             ((n) * 2 * OE_WINDOW_CYCLES / DISPLAY_TICK_CYCLES)
+
+#if OE_COUNT(1) == 0
+#error "Row shift leaves no on-time for the lowest brightness"
+#endif
+
+//------------------------------------------------------------------------------
+// Animations, played from flash by WDT_ISR one frame every period refresh
+// frames. Frames are ROWS words, one panel wide, shown on the left panel.
+// Number 0 is built in; number 1 is up to ANIM_INFO_FRAMES frames uploaded
+// into information memory segments D, C and B (0x1000-0x10BF, contiguous;
+// segment A holds the DCO calibration and is never touched).
+// A 64-byte segment holds ANIM_SEGMENT_FRAMES frames and is erased when the
+// first of them is stored, so store a segment's frames in order from its
+// first; any other frame is NAKed unless its flash is still blank.
+//------------------------------------------------------------------------------
+#define ANIM_BUILTIN            0
+#define ANIM_INFO               1
+#ifndef ANIM_INFO_ADDR                      // The host test points it at RAM
+#define ANIM_INFO_ADDR          ((const unsigned int *)0x1000)
+#endif
+#define ANIM_SEGMENT_FRAMES     (64 / (ROWS * 2))
+#define ANIM_INFO_FRAMES        (3 * ANIM_SEGMENT_FRAMES)
+#define FLASH_FN                (SMCLK_FREQ / 400000)   // 257-476 kHz clock
+
+//------------------------------------------------------------------------------
+// Display protocol. Every packet is
+//
+//      PROTO_SYNC | cmd | len | payload[len] | crc
+//
+// with crc the CRC-8 (polynomial x^8 + x^2 + x + 1, initial value 0) of cmd,
+// len and the payload. The device answers every packet with PROTO_ACK once
+// it has been carried out, or PROTO_NAK for a bad CRC, length or command.
+// A packet rejected before its CRC is still read to the end its len gives,
+// so the NAK comes once, after the whole packet.
+// A packet that gets no byte during a whole PROTO_TIMEOUT_MS period of
+// protoTimeout() (a byte was lost) is answered with PROTO_NAK, one to two
+// periods after its last byte.
+//
+// Flow control is stop-and-wait, and the receive path is built on it: there
+// is no receive buffer, and while a finished packet is carried out (up to a
+// frame for a page flip, ~15 ms with interrupts off for a store) the parser
+// takes nothing. The host sends one packet, then waits for its answer before
+// sending anything else; the answer is only queued once the parser is free
+// again, so nothing a host sends this way is lost. Bytes that arrive while a
+// packet is pending are dropped and counted in rxOverflow, so a host that
+// does not wait shows up there. A host that gets no answer within
+// 2 * PROTO_TIMEOUT_MS + 20 ms sends the packet again.
+//
+// Timer_A1_ISR feeds each character straight into protoByte(), which writes
+// the payload into its final place (the back page, textBuf) as it arrives
+// and wakes the main loop once per packet, when the CRC has been checked.
+// A frame, row, delta or store packet ends scrolling text when its length
+// arrives, as with two pages the text is kept in the back page.
+//
+//      cmd                   payload
+//      PROTO_CMD_FRAME       PAGE_WORDS words, little-endian, row 0 of
+//                            plane 0 first, ROW_WORDS words per row
+//      PROTO_CMD_ROW         plane * ROWS + row number, ROW_WORDS words
+//      PROTO_CMD_BRIGHTNESS  level 0 to BRIGHTNESS_MAX
+//      PROTO_CMD_TEXT        1 to TEXT_SIZE - 1 characters; scrolls if the
+//                            text is wider than the display
+//      PROTO_CMD_DELTA       changes to the last frame drawn, see below
+//      PROTO_CMD_PLAY        animation number, frame count (0 = all),
+//                            task ticks per animation frame (1 to 255)
+//      PROTO_CMD_STORE       frame number 0 to ANIM_INFO_FRAMES - 1, frame
+//                            as for PROTO_CMD_FRAME; stored for ANIM_INFO
+//
+// A delta payload walks the PAGE_WORDS * 2 frame bytes (row 0 low byte
+// first) with run-length coded XOR data. It applies to the last frame, row
+// or short text drawn, and a row packet keeps the other rows of it; after
+// scrolling text, an animation or a store, send a full frame. Each control
+// byte n is followed by
+//
+//      n = 0x00..0x7F        n + 1 bytes XORed into the next frame bytes
+//      n = 0x80..0xFF        nothing; the next n - 0x7F bytes stay as they are
+//
+// Bytes past the last run are unchanged. Runs must stay inside the frame.
+// Packet sizes and frame rates at 4800 baud (480 bytes/s), the 1 MHz rate,
+// for one plane and panel, counting the ACK the host waits for:
+//
+//      update                      FRAME       DELTA
+//      one pixel changed           21 B, 22/s  6-7 B, 68-80/s
+//      small sprite, 4 rows        21 B, 22/s  14 B, 34/s
+//      scroll, every byte changed  21 B, 22/s  22 B, 21/s
+//
+// Each rate doubles with UART_BAUD.
+//------------------------------------------------------------------------------
+#define PROTO_SYNC              0xA5
+#define PROTO_ACK               0x06
+#define PROTO_NAK               0x15
+#define PROTO_CMD_FRAME         0x01
+#define PROTO_CMD_ROW           0x02
+#define PROTO_CMD_BRIGHTNESS    0x03
+#define PROTO_CMD_TEXT          0x04
+#define PROTO_CMD_DELTA         0x05
+#define PROTO_CMD_PLAY          0x06
+#define PROTO_CMD_STORE         0x07
+#define PROTO_CMD_STATUS        0x08        // Device to host only
+#define PROTO_ARG_SIZE          3           // Largest non-frame payload
+#define PROTO_TIMEOUT_MS        100         // Longest gap inside a packet
+#define PROTO_TIMEOUT_TICKS     (PROTO_TIMEOUT_MS * 1000UL / TASK_TICK_US + 1)
+
+#if PAGE_WORDS * 2 > 255
+#error "Frame payload too long for the len byte, fewer PANELS or DISPLAY_PLANES"
+#endif
+
+#if PROTO_TIMEOUT_TICKS > 255
+#error "PROTO_TIMEOUT_MS is too long for a task period"
+#endif
+
+#ifdef TELEMETRY_MS
+#define TELEMETRY_TICKS         (TELEMETRY_MS * 1000UL / TASK_TICK_US)
+#if TELEMETRY_TICKS < 1 || TELEMETRY_TICKS > 255
+#error "TELEMETRY_MS is out of range for a task period"
+#endif
+#endif
+
+#define PROTO_WAIT_SYNC         0           // Parser states
+#define PROTO_WAIT_CMD          1
+#define PROTO_WAIT_LEN          2
+#define PROTO_WAIT_DATA         3
+#define PROTO_WAIT_CRC          4
+#define PROTO_WAIT_DELTA        5           // Payload of PROTO_CMD_DELTA
+#define PROTO_WAIT_SKIP         6           // Rest of a rejected packet
+
+//------------------------------------------------------------------------------
+// Conditions for the SW UART. UART_BAUD can be 4800, 9600, 19200, 38400 or
+// 57600; the ISR budget below decides which rates a given SMCLK_FREQ can
+// carry (4800 at 1 MHz, everything up to 57600 at 8 and 16 MHz).
+//
+// The bit time is kept in Q8, 1/256 of an SMCLK cycle. Both ISRs add the
+// integer part UART_TBIT to their CCR and carry the fraction UART_TBIT_FRAC
+// in an 8-bit accumulator, so every edge lands within one cycle of its ideal
+// time instead of drifting by the rounding error on every bit. Drift at the
+// stop bit sample with the rounded bit and half-bit times used before:
+//
+//      rate @ SMCLK      ideal    rounded   drift by stop bit    with Q8
+//      4800 @ 1 MHz      208.33   208       -3.2 cycles (1.5%)   < 1 cycle
+//      19200 @ 8 MHz     416.67   417       +2.7 cycles (0.6%)   < 1 cycle
+//      57600 @ 8 MHz     138.89   139       +0.6 cycles (0.4%)   < 1 cycle
+//      57600 @ 16 MHz    277.78   278       +2.1 cycles (0.8%)   < 1 cycle
+//------------------------------------------------------------------------------
+#ifndef UART_BAUD
+#define UART_BAUD           4800
+#endif
+#define UART_TBIT_Q8        ((SMCLK_FREQ * 256UL + UART_BAUD / 2) / UART_BAUD)
+#define UART_TBIT           (UART_TBIT_Q8 >> 8)
+#define UART_TBIT_FRAC      (UART_TBIT_Q8 & 0xFF)
+#define UART_TBIT_1_5_Q8    ((UART_TBIT_Q8 * 3 + 1) / 2)    // Edge to mid D0
+#define UART_TBIT_1_5       (UART_TBIT_1_5_Q8 >> 8)
+#define UART_TBIT_1_5_FRAC  (UART_TBIT_1_5_Q8 & 0xFF)
+
+// Define UART_AUTOBAUD to measure the bit time from a 'U' (0x55) sent by the
+// host after reset instead of relying on UART_BAUD alone. UART_BAUD is then
+// only the rate used until the first lock.
+//#define UART_AUTOBAUD
+
+//------------------------------------------------------------------------------
+// ISR cycle budget, counted from the MSP430 instruction timings for the
+// handlers below: 6 cycles interrupt entry, 3 per register push, 2 per pop,
+// 5 for reti, and the R12-R15 saves of a handler that calls a function. A
+// UART ISR has to reload its CCR and set up the next bit (TX output mode, RX
+// SCCI sample) before its next compare event one bit time later; that part
+// is the _SETUP count, the whole handler the plain count. Each ISR may first
+// wait for code running with interrupts off, and so may the one after it.
+//
+//      Timer_A0_ISR    setup + wait <= 1 bit
+//                      wait + whole + wait + setup <= 2 bits
+//      Timer_A1_ISR    same for a data bit
+//      start bit       start + wait <= 1.5 bits, to the middle of D0
+//      last bit        capture re-armed + wait <= 1.5 bits, before the
+//                      next start edge at the end of the stop bit
+//                      wait + last + wait + start <= 3 bits, when the next
+//                      start bit follows straight after the stop bit
+//
+// Every sum gets UART_MARGIN_PCT on top. The counts assume the obvious code
+// for each statement; a compiler that spills a register, picks a longer
+// addressing mode or reorders the output mode write behind the FIFO access
+// moves them by a few instructions, 10% of the largest sum. Re-count after
+// editing an ISR or an interrupts-off section, and keep the margin unless
+// the counts come from the listing of the build that ships.
+//
+// What a UART ISR can wait for:
+//
+//      WDT_ISR entry and exit, GIE clear       always
+//      main loop sleep check                   always, shorter than WDT_ISR
+//      protoTimeout() NAKing a stalled packet  line idle, shorter
+//      TimerA_UART_tx() starting the TX        TELEMETRY_MS only
+//      the other UART ISR                      TELEMETRY_MS only
+//      animStore(), ~15 ms                     never, the host waits
+//
+// Without TELEMETRY_MS the device only transmits answers, and the host
+// waits for each answer before it sends again, so TX and RX do not overlap.
+// The one exception is Timer_A0_ISR going idle at the end of the answer's
+// stop bit, after the host may already have started its next start bit;
+// that only delays the start bit capture. With TELEMETRY_MS status packets
+// go out at any time: Timer_A0_ISR has the higher priority but still waits
+// for a running Timer_A1_ISR, and Timer_A1_ISR waits for Timer_A0_ISR.
+//
+// The resulting shortest bit time, UART_TBIT_MIN, is 128 cycles without
+// TELEMETRY_MS, so 1 MHz carries 4800 baud and 8 MHz up to 57600. With
+// TELEMETRY_MS it is 338 cycles: 19200 at 8 MHz, 38400 at 16 MHz.
+//
+// setRows() and the shift routines run with interrupts on; they are checked
+// against the scan tick instead (WDT_ISR_ROW_CYCLES).
+//------------------------------------------------------------------------------
+#define TA0_ISR_SETUP_CYCLES    55          // Timer_A0_ISR, to the output mode
+#define TA0_ISR_CYCLES          89          // Timer_A0_ISR, loading next byte
+#define TA0_ISR_IDLE_CYCLES     70          // Timer_A0_ISR, going idle
+#define TA1_ISR_START_CYCLES    53          // Timer_A1_ISR, start bit
+#define TA1_ISR_SETUP_CYCLES    62          // Timer_A1_ISR, to the SCCI sample
+#define TA1_ISR_CYCLES          88          // Timer_A1_ISR, data bit
+#define TA1_ISR_CAP_CYCLES      84          // Timer_A1_ISR, last bit to CAP set
+#define TA1_ISR_LAST_CYCLES     235         // Timer_A1_ISR, last bit + parser
+#define WDT_ISR_MASKED_CYCLES   30          // WDT_ISR entry or exit, GIE clear
+                                            // (longer than all of USI_ISR)
+#define UART_TX_MASKED_CYCLES   31          // TimerA_UART_tx(), TX idle
+#define UART_MARGIN_PCT         10
+
+#define UART_MAX(a, b)          ((a) > (b) ? (a) : (b))
+#ifdef TELEMETRY_MS
+#define TA0_ISR_WAIT            UART_MAX(WDT_ISR_MASKED_CYCLES, TA1_ISR_LAST_CYCLES)
+#define TA1_ISR_WAIT            UART_MAX(UART_MAX(WDT_ISR_MASKED_CYCLES,      \
+                                                  UART_TX_MASKED_CYCLES),     \
+                                         TA0_ISR_CYCLES)
+#else
+#define TA0_ISR_WAIT            WDT_ISR_MASKED_CYCLES
+#define TA1_ISR_WAIT            WDT_ISR_MASKED_CYCLES
+#endif
+
+// Shortest bit time all the checks below allow, also the autobaud lower
+// limit. UART_BITS_MIN(c, n) is the bit time whose n/2 bit times fit c
+// cycles plus the margin.
+#define UART_MARGIN(c)          (((c) * (100 + UART_MARGIN_PCT) + 99) / 100)
+#define UART_BITS_MIN(c, n)     ((UART_MARGIN(c) * 2 + (n) - 1) / (n))
+#define UART_TBIT_MIN_TA0       UART_MAX(UART_BITS_MIN(TA0_ISR_SETUP_CYCLES + \
+                                                       TA0_ISR_WAIT, 2),      \
+                                         UART_BITS_MIN(TA0_ISR_WAIT * 2 +     \
+                                                       TA0_ISR_CYCLES +       \
+                                                       TA0_ISR_SETUP_CYCLES, 4))
+#define UART_TBIT_MIN_BIT       UART_MAX(UART_BITS_MIN(TA1_ISR_SETUP_CYCLES + \
+                                                       TA1_ISR_WAIT, 2),      \
+                                         UART_BITS_MIN(TA1_ISR_WAIT * 2 +     \
+                                                       TA1_ISR_CYCLES +       \
+                                                       TA1_ISR_SETUP_CYCLES, 4))
+#define UART_TBIT_MIN_START     UART_BITS_MIN(TA1_ISR_START_CYCLES +          \
+                                              UART_MAX(TA1_ISR_WAIT,          \
+                                                       TA0_ISR_IDLE_CYCLES), 3)
+#define UART_TBIT_MIN_LAST      UART_MAX(UART_BITS_MIN(TA1_ISR_CAP_CYCLES +   \
+                                                       TA1_ISR_WAIT, 3),      \
+                                         UART_BITS_MIN(TA1_ISR_WAIT * 2 +     \
+                                                       TA1_ISR_LAST_CYCLES +  \
+                                                       TA1_ISR_START_CYCLES, 6))
+#define UART_TBIT_MIN           UART_MAX(UART_MAX(UART_TBIT_MIN_TA0,          \
+                                                  UART_TBIT_MIN_BIT),         \
+                                         UART_MAX(UART_TBIT_MIN_START,        \
+                                                  UART_TBIT_MIN_LAST))
+
+#if UART_TBIT_MIN_TA0 > UART_TBIT
+#error "Timer_A0_ISR does not fit in one UART bit time, lower UART_BAUD"
+#endif
+#if UART_TBIT_MIN_START > UART_TBIT
+#error "Timer_A1_ISR start bit does not fit before D0, lower UART_BAUD"
+#endif
+#if UART_TBIT_MIN_BIT > UART_TBIT
+#error "Timer_A1_ISR does not fit in one UART bit time, lower UART_BAUD"
+#endif
+#if UART_TBIT_MIN_LAST > UART_TBIT
+#error "Timer_A1_ISR last bit does not fit before the next start bit, lower UART_BAUD"
+#endif
+
+//------------------------------------------------------------------------------
+// Transmit FIFO, drained by Timer_A0_ISR. Size must be a power of two; head
+// and tail run freely and are masked on access, so all slots are usable.
+// Answers are single bytes; with TELEMETRY_MS a whole status packet fits.
+//------------------------------------------------------------------------------
+#ifdef TELEMETRY_MS
+#define UART_TX_SIZE        8
+#else
+#define UART_TX_SIZE        4
+#endif
+#define UART_TX_MASK        (UART_TX_SIZE - 1)
+
+//------------------------------------------------------------------------------
+// RAM. The G2231 has 128 bytes for the globals below and the stack. Default
+// build (one panel, one plane, two pages):
+//
+//      frame pages and page pointers           36
+//      marquee text pointer and position        4  (text in the back page)
+//      parser state, protoTimeout()            14
+//      UART: TX FIFO, shift registers, drops   15
+//      scheduler, events, animation, row       10
+//      total                                   79, 80 as laid out
+//
+// TELEMETRY_MS adds 8 bytes, UART_AUTOBAUD 13, grayscale 4 of scan state
+// and the 8 and 16 MHz task tick prescaler 1; a single page adds textBuf.
+//
+// Stack, measured from the frames clang -Os builds for the MSP430 (saved
+// registers, locals and return addresses, plus 4 bytes of PC and SR per
+// interrupt), default build:
+//
+//      main loop asleep, from the startup code                  4
+//      main loop at its deepest: protoExecute(), showText(),
+//      drawChar() and the multiply helper for a short text     34
+//      WDT_ISR shifting a row: setRows(), shiftByte()          28
+//      Timer_A1_ISR, protoByte() folded in                     10
+//      Timer_A0_ISR 10, USI_ISR 4; one UART ISR at a time
+//
+// Main loop work runs with the scan held (see the main loop events), so
+// the worst case is its deepest chain plus a UART ISR, 44 bytes, against
+// WDT_ISR and a UART ISR over the sleeping main loop, 42: 4 of the 48 bytes
+// spare. DISPLAY_LPM3 (WDT_ISR 32, 2 spare), SHIFT_USE_USI (WDT_ISR 18) and
+// the 8 and 16 MHz builds (3 spare) fit as well. TELEMETRY_MS is 5 bytes
+// short, UART_AUTOBAUD (whose Timer_A1_ISR calls and so saves R12-R15) 16,
+// and the single-page builds 16 and more. Re-measure after adding state or
+// calls.
 //------------------------------------------------------------------------------
-#define UART_TBIT_DIV_2     (1000000 / (9600 * 2))
-#define UART_TBIT           (1000000 / 9600)
 
 //------------------------------------------------------------------------------
 // Global variables used for full-duplex UART communication
 //------------------------------------------------------------------------------
+#ifdef UART_AUTOBAUD
+#define UART_TIMING                         // Set by autobaud, in RAM
+#else
+#define UART_TIMING             const       // Fixed, kept in flash
+#endif
 unsigned int txData;                        // UART internal variable for TX
-unsigned char rxBuffer;                     // Received UART character
-unsigned int buffer[10];
+UART_TIMING unsigned int uartTbit = UART_TBIT;          // Bit time, cycles
+UART_TIMING unsigned char uartTbitFrac = UART_TBIT_FRAC;    // and Q8 fraction
+UART_TIMING unsigned int uartTbit15 = UART_TBIT_1_5;    // 1.5 bit times
+UART_TIMING unsigned char uartTbit15Frac = UART_TBIT_1_5_FRAC;
+#ifdef UART_AUTOBAUD
+volatile unsigned char uartAutobaud;        // 0 = locked, else 1 + edges seen
+#endif
+volatile unsigned int rxOverflow;           // Characters dropped, parser busy
+unsigned char txBuffer[UART_TX_SIZE];       // Characters waiting for TX
+volatile unsigned char txHead;              // Written by TimerA_UART_tx only
+volatile unsigned char txTail;              // Written by Timer_A0_ISR only
+
+//------------------------------------------------------------------------------
+// Display pages. WDT_ISR scans displayFront while the main loop composes the
+// next frame in displayBack; displayFlip() hands it over in the frame gap.
+// With a single page both point to it.
+//------------------------------------------------------------------------------
+volatile unsigned int frameBuf[DISPLAY_PAGES][PAGE_WORDS];
+volatile unsigned int *displayFront = frameBuf[0];
+volatile unsigned int *displayBack = frameBuf[DISPLAY_PAGES - 1];
+
+//------------------------------------------------------------------------------
+// P2OUT decoder pattern for each row, applied by setRows() in one store
+//------------------------------------------------------------------------------
+const unsigned char rowSelect[ROWS] = {
+    0,           ROW0,        ROW1,        ROW1 + ROW0,
+    ROW2,        ROW2 + ROW0, ROW2 + ROW1, ROW2 + ROW1 + ROW0
+};
+
+// Shifted by the first gap tick in place of a row, in flash
+const unsigned int rowBlank[ROW_WORDS] = { 0 };
+
+// USI counts of on-time for each brightness below BRIGHTNESS_MAX, in flash
+const unsigned char oeCount[BRIGHTNESS_MAX] = {
+    OE_COUNT(0),  OE_COUNT(1),  OE_COUNT(2),  OE_COUNT(3),  OE_COUNT(4),
+    OE_COUNT(5),  OE_COUNT(6),  OE_COUNT(7),  OE_COUNT(8),  OE_COUNT(9),
+    OE_COUNT(10), OE_COUNT(11), OE_COUNT(12), OE_COUNT(13), OE_COUNT(14)
+};
+
+//------------------------------------------------------------------------------
+// Marquee state. marqueeText is 0 while no text is scrolling; marqueeStep()
+// owns the other fields while TASK_MARQUEE runs. With two pages the text is
+// received into the back page, which has nothing else to hold while text
+// scrolls: showText() copies what it draws in place, and marqueeStart()
+// blanks only the front page.
+//------------------------------------------------------------------------------
+#if DISPLAY_PAGES > 1
+#define textBuf                 ((char *)displayBack)   // Text shown or scrolling
+#else
+char textBuf[TEXT_SIZE];                    // Text shown or scrolling
+#endif
+const char * volatile marqueeText;          // Scrolling text, 0 if stopped
+unsigned char marqueePos;                   // Character entering the display
+unsigned char marqueeMask;                  // Glyph column entering, as a bit
+
+//------------------------------------------------------------------------------
+// Animation state, owned by animStep() while TASK_ANIM runs
+//------------------------------------------------------------------------------
+const unsigned int *animFirst;              // Frame 0, in flash
+unsigned char animPos;                      // Next frame to show
+unsigned char animCount;
+unsigned char animPeriod;                   // Task ticks per frame
+
+//------------------------------------------------------------------------------
+// Scheduler state
+//------------------------------------------------------------------------------
+unsigned char taskCount[TASKS];             // Task ticks to the next run, 0 = idle
+
+//------------------------------------------------------------------------------
+// Main loop events
+//------------------------------------------------------------------------------
+volatile unsigned char events;              // Pending 1 << EV_x, but EV_PACKET
+#ifdef TELEMETRY_MS
+unsigned int eventLatencyMax;               // Worst EV_PACKET latency, cycles
+#endif
+
+//------------------------------------------------------------------------------
+// Display settings and protocol parser state
+//------------------------------------------------------------------------------
+volatile unsigned char displayBrightness = BRIGHTNESS_MAX;
+#if DISPLAY_PLANES > 1
+unsigned char displayHold;                  // Ticks left on the current plane
+volatile unsigned char oeHold;              // On-time counts still to chain
+unsigned char oeRun;                        // USICNT for each of them
+#endif
+volatile unsigned char protoReady;          // PROTO_ACK/NAK for main, 0 idle
+#ifdef TELEMETRY_MS
+unsigned char protoTimedOut;                // protoReady set by protoTimeout()
+#endif
+unsigned char protoState;                   // PROTO_WAIT_*
+unsigned char protoCmd;
+unsigned char protoLen;
+unsigned char protoPos;                     // Payload bytes received
+unsigned char protoCrc;                     // Running CRC-8
+volatile unsigned char *protoDest;          // Where the next payload byte goes
+unsigned char protoArg[PROTO_ARG_SIZE];     // Row, brightness, play args
+unsigned char protoRun;                     // Delta XOR bytes left in run
+volatile unsigned char protoProgress;       // Set per byte, cleared by protoTimeout()
+
+//------------------------------------------------------------------------------
+// CRC-8 of the high nibble i followed by four zero bits, polynomial 0x07
+//------------------------------------------------------------------------------
+const unsigned char crc8Table[16] = {
+    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15,
+    0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D
+};
+
+//------------------------------------------------------------------------------
+// Built-in animation ANIM_BUILTIN: a square growing out of the centre
+//------------------------------------------------------------------------------
+const unsigned int animPing[4][ROWS] = {
+    { 0x0000, 0x0000, 0x0000, 0x0180, 0x0180, 0x0000, 0x0000, 0x0000 },
+    { 0x0000, 0x0000, 0x03C0, 0x0240, 0x0240, 0x03C0, 0x0000, 0x0000 },
+    { 0x0000, 0x07E0, 0x0420, 0x0420, 0x0420, 0x0420, 0x07E0, 0x0000 },
+    { 0x0FF0, 0x0810, 0x0810, 0x0810, 0x0810, 0x0810, 0x0810, 0x0FF0 }
+};
+
+//------------------------------------------------------------------------------
+// Font table in flash. Stored row-major like the scan: one byte per glyph
+// row, bit 0 = leftmost pixel, so a glyph row ORs straight into a row word.
+//------------------------------------------------------------------------------
+const unsigned char font[FONT_LAST - FONT_FIRST + 1][FONT_HEIGHT] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // 0x20 ' '
+    { 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04 }, // 0x21 '!'
+    { 0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00 }, // 0x22 '"'
+    { 0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A }, // 0x23 '#'
+    { 0x04, 0x1E, 0x05, 0x0E, 0x14, 0x0F, 0x04 }, // 0x24 '$'
+    { 0x03, 0x13, 0x08, 0x04, 0x02, 0x19, 0x18 }, // 0x25 '%'
+    { 0x06, 0x09, 0x05, 0x02, 0x15, 0x09, 0x16 }, // 0x26 '&'
+    { 0x06, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00 }, // 0x27 '''
+    { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 }, // 0x28 '('
+    { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 }, // 0x29 ')'
+    { 0x00, 0x0A, 0x04, 0x1F, 0x04, 0x0A, 0x00 }, // 0x2A '*'
+    { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 }, // 0x2B '+'
+    { 0x00, 0x00, 0x00, 0x00, 0x06, 0x04, 0x02 }, // 0x2C ','
+    { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 }, // 0x2D '-'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x06, 0x06 }, // 0x2E '.'
+    { 0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00 }, // 0x2F '/'
+    { 0x0E, 0x11, 0x19, 0x15, 0x13, 0x11, 0x0E }, // 0x30 '0'
+    { 0x04, 0x06, 0x04, 0x04, 0x04, 0x04, 0x0E }, // 0x31 '1'
+    { 0x0E, 0x11, 0x10, 0x08, 0x04, 0x02, 0x1F }, // 0x32 '2'
+    { 0x1F, 0x08, 0x04, 0x08, 0x10, 0x11, 0x0E }, // 0x33 '3'
+    { 0x08, 0x0C, 0x0A, 0x09, 0x1F, 0x08, 0x08 }, // 0x34 '4'
+    { 0x1F, 0x01, 0x0F, 0x10, 0x10, 0x11, 0x0E }, // 0x35 '5'
+    { 0x0C, 0x02, 0x01, 0x0F, 0x11, 0x11, 0x0E }, // 0x36 '6'
+    { 0x1F, 0x10, 0x08, 0x04, 0x02, 0x02, 0x02 }, // 0x37 '7'
+    { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E }, // 0x38 '8'
+    { 0x0E, 0x11, 0x11, 0x1E, 0x10, 0x08, 0x06 }, // 0x39 '9'
+    { 0x00, 0x06, 0x06, 0x00, 0x06, 0x06, 0x00 }, // 0x3A ':'
+    { 0x00, 0x06, 0x06, 0x00, 0x06, 0x04, 0x02 }, // 0x3B ';'
+    { 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08 }, // 0x3C '<'
+    { 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00 }, // 0x3D '='
+    { 0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02 }, // 0x3E '>'
+    { 0x0E, 0x11, 0x10, 0x08, 0x04, 0x00, 0x04 }, // 0x3F '?'
+    { 0x0E, 0x11, 0x10, 0x16, 0x15, 0x15, 0x0E }, // 0x40 '@'
+    { 0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11 }, // 0x41 'A'
+    { 0x0F, 0x11, 0x11, 0x0F, 0x11, 0x11, 0x0F }, // 0x42 'B'
+    { 0x0E, 0x11, 0x01, 0x01, 0x01, 0x11, 0x0E }, // 0x43 'C'
+    { 0x07, 0x09, 0x11, 0x11, 0x11, 0x09, 0x07 }, // 0x44 'D'
+    { 0x1F, 0x01, 0x01, 0x0F, 0x01, 0x01, 0x1F }, // 0x45 'E'
+    { 0x1F, 0x01, 0x01, 0x07, 0x01, 0x01, 0x01 }, // 0x46 'F'
+    { 0x0E, 0x11, 0x01, 0x01, 0x19, 0x11, 0x0E }, // 0x47 'G'
+    { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 }, // 0x48 'H'
+    { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E }, // 0x49 'I'
+    { 0x1C, 0x08, 0x08, 0x08, 0x08, 0x09, 0x06 }, // 0x4A 'J'
+    { 0x11, 0x09, 0x05, 0x03, 0x05, 0x09, 0x11 }, // 0x4B 'K'
+    { 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x1F }, // 0x4C 'L'
+    { 0x11, 0x1B, 0x15, 0x11, 0x11, 0x11, 0x11 }, // 0x4D 'M'
+    { 0x11, 0x11, 0x13, 0x15, 0x19, 0x11, 0x11 }, // 0x4E 'N'
+    { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, // 0x4F 'O'
+    { 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x01, 0x01 }, // 0x50 'P'
+    { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x09, 0x16 }, // 0x51 'Q'
+    { 0x0F, 0x11, 0x11, 0x0F, 0x05, 0x09, 0x11 }, // 0x52 'R'
+    { 0x1E, 0x01, 0x01, 0x0E, 0x10, 0x10, 0x0F }, // 0x53 'S'
+    { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 }, // 0x54 'T'
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, // 0x55 'U'
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 }, // 0x56 'V'
+    { 0x11, 0x11, 0x11, 0x15, 0x15, 0x1B, 0x11 }, // 0x57 'W'
+    { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 }, // 0x58 'X'
+    { 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x04 }, // 0x59 'Y'
+    { 0x1F, 0x10, 0x08, 0x04, 0x02, 0x01, 0x1F }, // 0x5A 'Z'
+    { 0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E }, // 0x5B '['
+    { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 }, // 0x5C backslash
+    { 0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E }, // 0x5D ']'
+    { 0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00 }, // 0x5E '^'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F }, // 0x5F '_'
+};
 //------------Adding
-void delay ( unsigned int );
-void pulseClock ( void );
-void pinWrite ( unsigned int, unsigned int );
-void shiftOut ( unsigned int );
+void shiftInit ( void );
+void shiftData ( unsigned int );
+void shiftRow ( const volatile unsigned int * );
+void latch ( void );
+#ifndef SHIFT_USE_USI
+void shiftByte ( unsigned char );
+#endif
 void enable ( void );
 void disable ( void );
-void setRows( unsigned int, unsigned int);
-void print( char );
+void rowEnable ( void );
+void oeStop ( void );
+void setRows( unsigned int, const volatile unsigned int * );
+const unsigned char *fontGlyph( unsigned char );
+void drawChar( unsigned char, unsigned char );
+void displayInit( void );
+void displayFlip( void );
+void marqueeStart( const char * );
+void marqueeStop( void );
+unsigned char marqueeStep( void );
+void animStart( const unsigned int *, unsigned char, unsigned char );
+void animStop( void );
+unsigned char animStep( void );
+unsigned char animStore( unsigned char );
+void taskStart( unsigned char, unsigned char );
+void taskStop( unsigned char );
+void taskSchedule( void );
+unsigned char protoTimeout( void );
+#ifdef TELEMETRY_MS
+unsigned char telemetryTick( void );
+void telemetrySend( void );
+#endif
+void showText( unsigned char );
+unsigned char crc8( unsigned char, unsigned char );
+static inline unsigned char protoByte( unsigned char );
+unsigned char protoSkip( void );
+unsigned char protoDone( unsigned char );
+void protoExecute( void );
+unsigned char protoPlay( void );
+void displaySync( void );
 //---------------
 
 //------------------------------------------------------------------------------
@@ -78,6 +921,21 @@ void print( char );
 void TimerA_UART_init(void);
 void TimerA_UART_tx(unsigned char byte);
 void TimerA_UART_print(char *string);
+void TimerA_UART_flush(void);
+#ifdef UART_AUTOBAUD
+void TimerA_UART_autobaud(void);
+unsigned char TimerA_UART_autobaudEdge(void);
+#endif
+
+//------------------------------------------------------------------------------
+// Main loop event handlers, indexed by EV_*
+//------------------------------------------------------------------------------
+void (* const eventRun[EVENTS])(void) = {
+    protoExecute, taskSchedule,
+#ifdef TELEMETRY_MS
+    telemetrySend
+#endif
+};
 
 //------------------------------------------------------------------------------
 // main()
@@ -86,9 +944,16 @@ void main(void)
 {
     WDTCTL = WDTPW + WDTHOLD;               // Stop watchdog timer
 
-    DCOCTL = 0x00;                          // Set DCOCLK to 1MHz
-    BCSCTL1 = CALBC1_1MHZ;
-    DCOCTL = CALDCO_1MHZ;
+    DCOCTL = 0x00;                          // Set DCOCLK to SMCLK_FREQ
+    BCSCTL1 = DCO_CALBC1;
+    DCOCTL = DCO_CALDCO;
+#ifdef DISPLAY_LPM3
+    BCSCTL3 = LFXT1S_0 + XCAP_3;            // 32768 Hz crystal, 12.5 pF
+    do {
+        IFG1 &= ~OFIFG;                     // Wait for LFXT1 to start
+        __delay_cycles(SMCLK_FREQ / 1000);
+    } while (IFG1 & OFIFG);
+#endif
 
     P1OUT = 0x00;                           // Initialize all GPIO
     P1SEL = UART_TXD + UART_RXD;            // Timer function for TXD/RXD pins
@@ -96,33 +961,67 @@ void main(void)
     P2OUT = 0x00;
     P2SEL = 0x00;
     P2DIR = 0xFF;
+    shiftInit();
 
     __enable_interrupt();
     
     TimerA_UART_init();                     // Start Timer_A UART
+#ifdef UART_AUTOBAUD
+    TimerA_UART_autobaud();                 // Wait for the host's 'U'
+    __disable_interrupt();
+    while (uartAutobaud) {
+        __bis_SR_register(LPM0_bits + GIE);
+        __disable_interrupt();
+    }
+    __enable_interrupt();
+#endif
     TimerA_UART_print("G2xx1 TimerA UART\r\n");
     TimerA_UART_print("READY.\r\n");
     enable();
+    displayInit();                          // Start background row scan
+    taskStart(TASK_PROTO, PROTO_TIMEOUT_TICKS);
+#ifdef TELEMETRY_MS
+    taskStart(TASK_TELEMETRY, TELEMETRY_TICKS);
+#endif
     for (;;)
     {
-        // Wait for incoming character
-        __bis_SR_register(LPM0_bits);
-        //print();
-		//setRows(0, buffer[0]);   
-		shiftOut(rxBuffer);
-        // Update board outputs according to received byte
-        /*
-        if (rxBuffer & 0x01) P1OUT |= 0x01; else P1OUT &= ~0x01;    // P1.0
-        if (rxBuffer & 0x02) P1OUT |= 0x08; else P1OUT &= ~0x08;    // P1.3
-        if (rxBuffer & 0x04) P1OUT |= 0x10; else P1OUT &= ~0x10;    // P1.4
-        if (rxBuffer & 0x08) P1OUT |= 0x20; else P1OUT &= ~0x20;    // P1.5
-        if (rxBuffer & 0x10) P1OUT |= 0x40; else P1OUT &= ~0x40;    // P1.6
-        if (rxBuffer & 0x20) P1OUT |= 0x80; else P1OUT &= ~0x80;    // P1.7
-        if (rxBuffer & 0x40) P2OUT |= 0x40; else P2OUT &= ~0x40;    // P2.6
-        if (rxBuffer & 0x80) P2OUT |= 0x80; else P2OUT &= ~0x80;    // P2.7
-        */
-        // Echo received character
-        TimerA_UART_tx(rxBuffer);
+        unsigned char ready;
+        unsigned char ev;
+
+        // Events only run while WDT_ISR has handed over the frame gap, with
+        // its interrupt off; the scan goes back on before the sleep once
+        // they are done. Interrupts are disabled from the check to the
+        // sleep, so a hand-over in between still wakes us up. With
+        // DISPLAY_LPM3 the UART ISRs also wake us whenever the UART goes
+        // idle, to drop from LPM0 to LPM3, and so does every WDT_ISR tick.
+        __disable_interrupt();
+        ready = 0;
+        if (!(IE1 & WDTIE)) {               // Frame gap, the scan is held
+            ready = events;
+            if (protoReady) {
+                ready |= 1 << EV_PACKET;
+            }
+            if (!ready) {
+                IE1 |= WDTIE;               // Done, resume the scan
+            }
+        }
+        if (!ready) {
+#ifdef DISPLAY_LPM3
+            if (!(TACCTL0 & CCIE) && (TACCTL1 & CAP)) {     // UART idle
+                TACCTL1 &= ~SCS;            // Capture with SMCLK stopped
+                __bis_SR_register(LPM3_bits + GIE);
+                continue;
+            }
+#endif
+            __bis_SR_register(LPM0_bits + GIE);
+            continue;
+        }
+        for (ev = 0; !(ready & 1); ev++) {  // Highest priority first
+            ready >>= 1;
+        }
+        events &= ~(1 << ev);
+        __enable_interrupt();
+        eventRun[ev]();
     }
 }
 //------------------------------------------------------------------------------
@@ -135,17 +1034,21 @@ void TimerA_UART_init(void)
     TACTL = TASSEL_2 + MC_2;                // SMCLK, start in continuous mode
 }
 //------------------------------------------------------------------------------
-// Outputs one byte using the Timer_A UART
+// Queues one byte for the Timer_A UART. Returns immediately unless the FIFO
+// is full, in which case it waits for Timer_A0_ISR to free a slot.
 //------------------------------------------------------------------------------
 void TimerA_UART_tx(unsigned char byte)
 {
-    while (TACCTL0 & CCIE);                 // Ensure last char got TX'd
-    TACCR0 = TAR;                           // Current state of TA counter
-    TACCR0 += UART_TBIT;                    // One bit time till first bit
-    TACCTL0 = OUTMOD0 + CCIE;               // Set TXD on EQU0, Int
-    txData = byte;                          // Load global variable
-    txData |= 0x100;                        // Add mark stop bit to TXData
-    txData <<= 1;                           // Add space start bit
+    while ((unsigned char)(txHead - txTail) >= UART_TX_SIZE);
+    txBuffer[txHead & UART_TX_MASK] = byte;
+    __disable_interrupt();                  // ISR must not go idle in between
+    txHead++;
+    if (!(TACCTL0 & CCIE)) {                // Transmitter idle, start it
+        TACCR0 = TAR;                       // Current state of TA counter
+        TACCR0 += uartTbit;                 // One bit time till first bit
+        TACCTL0 = OUTMOD0 + CCIE;           // Set TXD on EQU0, Int
+    }
+    __enable_interrupt();
 }
 
 //------------------------------------------------------------------------------
@@ -158,28 +1061,104 @@ void TimerA_UART_print(char *string)
     }
 }
 //------------------------------------------------------------------------------
+// Waits until every queued byte has been shifted out
+//------------------------------------------------------------------------------
+void TimerA_UART_flush(void)
+{
+    while (TACCTL0 & CCIE);                 // ISR disables itself when empty
+}
+#ifdef UART_AUTOBAUD
+//------------------------------------------------------------------------------
+// Starts automatic baud rate detection. Reception stops until the host has
+// sent a 'U' (0x55); the character itself is consumed by the measurement.
+//------------------------------------------------------------------------------
+void TimerA_UART_autobaud(void)
+{
+    uartAutobaud = 1;                       // Armed, no edges yet
+}
+//------------------------------------------------------------------------------
+// Called by Timer_A1_ISR with the time of a falling RXD edge in TACCR1 while
+// autobaud is armed. 'U' has five falling edges two bits apart (start bit,
+// D1, D3, D5, D7), so the first to the fifth spans exactly eight bit times
+// and the bit time falls out as span / 8 in Q8 without a division. An
+// interval more than 1/8 off the first one (another character, a glitch)
+// restarts the measurement from that edge, and so does a bit time below
+// UART_TBIT_MIN. Returns 1 once the new bit time is in place.
+//------------------------------------------------------------------------------
+unsigned char TimerA_UART_autobaudEdge(void)
+{
+    static unsigned int abFirst;            // First edge of the measurement
+    static unsigned int abLast;             // Previous edge
+    static unsigned int abInterval;         // First edge-to-edge interval
+    unsigned int now = TACCR1;
+    unsigned int interval = now - abLast;
+    unsigned int span;
+    unsigned long tbit15;
+
+    if (uartAutobaud > 2 &&
+        (interval > abInterval + (abInterval >> 3) ||
+         interval < abInterval - (abInterval >> 3))) {
+        uartAutobaud = 1;                   // Not a 'U', restart here
+    }
+    if (uartAutobaud == 1) {
+        abFirst = now;
+    }
+    else if (uartAutobaud == 2) {
+        abInterval = interval;
+    }
+    abLast = now;
+    if (++uartAutobaud < 6) {
+        return 0;
+    }
+    span = now - abFirst;                   // Eight bit times
+    if ((span >> 3) < UART_TBIT_MIN) {
+        abFirst = now;                      // Too fast to serve, start over
+        uartAutobaud = 2;
+        return 0;
+    }
+    uartTbit = span >> 3;
+    uartTbitFrac = (span & 0x07) << 5;
+    tbit15 = (unsigned long)span * 48;      // 1.5 bit times in Q8
+    uartTbit15 = tbit15 >> 8;
+    uartTbit15Frac = (unsigned char)tbit15;
+    uartAutobaud = 0;                       // Locked, next edge is a start bit
+    return 1;
+}
+#endif
+//------------------------------------------------------------------------------
 // Timer_A UART - Transmit Interrupt Handler
 //------------------------------------------------------------------------------
 #pragma vector = TIMERA0_VECTOR
 __interrupt void Timer_A0_ISR(void)
 {
-    static unsigned char txBitCnt = 10;
+    static unsigned char txBitCnt = 0;
+    static unsigned char txFrac = 0;
 
-    TACCR0 += UART_TBIT;                    // Add Offset to CCRx
+    txFrac += uartTbitFrac;                 // Q8 fraction, carry adds a cycle
+    TACCR0 += uartTbit + (txFrac < uartTbitFrac);
     if (txBitCnt == 0) {                    // All bits TXed?
-        TACCTL0 &= ~CCIE;                   // All bits TXed, disable interrupt
-        txBitCnt = 10;                      // Re-load bit counter
+        if (txHead == txTail) {             // FIFO empty
+            TACCTL0 &= ~CCIE;               // Go idle, disable interrupt
+#ifdef DISPLAY_LPM3
+            __bic_SR_register_on_exit(LPM3_bits);  // Main may enter LPM3
+#endif
+            return;
+        }
+        TACCTL0 |= OUTMOD2;                 // TX start bit before the FIFO read
+        txData = txBuffer[txTail & UART_TX_MASK];
+        txTail++;                           // Frees the FIFO slot
+        txData |= 0x100;                    // Add mark stop bit to TXData
+        txBitCnt = 9;                       // Re-load bit counter
+        return;
+    }
+    if (txData & 0x01) {
+      TACCTL0 &= ~OUTMOD2;                  // TX Mark '1'
     }
     else {
-        if (txData & 0x01) {
-          TACCTL0 &= ~OUTMOD2;              // TX Mark '1'
-        }
-        else {
-          TACCTL0 |= OUTMOD2;               // TX Space '0'
-        }
-        txData >>= 1;
-        txBitCnt--;
+      TACCTL0 |= OUTMOD2;                   // TX Space '0'
     }
+    txData >>= 1;
+    txBitCnt--;
 }      
 //------------------------------------------------------------------------------
 // Timer_A UART - Receive Interrupt Handler
@@ -189,81 +1168,157 @@ __interrupt void Timer_A1_ISR(void)
 {
     static unsigned char rxBitCnt = 8;
     static unsigned char rxData = 0;
+    static unsigned char rxFrac = 0;
 
     switch (__even_in_range(TAIV, TAIV_TAIFG)) { // Use calculated branching
         case TAIV_TACCR1:                        // TACCR1 CCIFG - UART RX
-            TACCR1 += UART_TBIT;                 // Add Offset to CCRx
             if (TACCTL1 & CAP) {                 // Capture mode = start bit edge
-                TACCTL1 &= ~CAP;                 // Switch capture to compare mode
-                TACCR1 += UART_TBIT_DIV_2;       // Point CCRx to middle of D0
+#ifdef UART_AUTOBAUD
+                if (uartAutobaud) {              // Timing the sync character
+                    if (TimerA_UART_autobaudEdge()) {
+                        __bic_SR_register_on_exit(LPM0_bits);  // Locked
+                    }
+                }
+                else
+#endif
+                {
+                    TACCTL1 &= ~CAP;             // Switch capture to compare mode
+                    TACCR1 += uartTbit15;        // Point CCRx to middle of D0
+                    rxFrac = uartTbit15Frac;     // Start fraction for this frame
+#ifdef DISPLAY_LPM3
+                    TACCTL1 |= SCS;              // Next capture is synchronous
+                    __bic_SR_register_on_exit(SCG1 + SCG0);  // Keep SMCLK on
+#endif
+                }
             }
             else {
+                rxFrac += uartTbitFrac;          // Q8 fraction, carry adds a cycle
+                TACCR1 += uartTbit + (rxFrac < uartTbitFrac);
                 rxData >>= 1;
                 if (TACCTL1 & SCCI) {            // Get bit waiting in receive latch
                     rxData |= 0x80;
                 }
                 rxBitCnt--;
                 if (rxBitCnt == 0) {             // All bits RXed?
-                    rxBuffer = rxData;           // Store in global variable
                     rxBitCnt = 8;                // Re-load bit counter
                     TACCTL1 |= CAP;              // Switch compare to capture mode
-                    __bic_SR_register_on_exit(LPM0_bits);  // Clear LPM0 bits from 0(SR)
+                    if (protoReady) {            // Main loop still busy, drop it
+                        rxOverflow++;
+                    }
+                    else if (protoByte(rxData)) {    // Packet complete
+                        __bic_SR_register_on_exit(LPM3_bits);  // Clear LPM3 bits from 0(SR)
+                    }
+#ifdef DISPLAY_LPM3
+                    __bic_SR_register_on_exit(LPM3_bits);  // Main may enter LPM3
+#endif
                 }
             }
             break;
     }
 }
 //------------------------Adding
-void delay(unsigned int ms)
+#ifdef SHIFT_USE_USI
+// Set up the USI as an SPI master: SDO and SCLK enabled, LSB first, SCLK
+// from SMCLK. SCLK idles low with USICKPH set, so each bit is presented
+// before the rising edge on which the 74HC595 samples it.
+void shiftInit( void )
 {
- while (ms--)
-    {
-        __delay_cycles(1000); // set for 16Mhz change it to 1000 for 1 Mhz
-    }
+  USICTL0 = USIPE6 + USIPE5 + USILSB + USIMST + USIOE + USISWRST;
+  USICTL1 = USICKPH;
+  USICKCTL = USIDIV_0 + USISSEL_2;
+  USICTL0 &= ~USISWRST;                     // Release USI for operation
 }
- 
-// Writes a value to the specified bitmask/pin. Use built in defines
-// when calling this, as the shiftOut() function does.
-// All nonzero values are treated as "high" and zero is "low"
-void pinWrite( unsigned int bit, unsigned int val )
-{
-  if (val){
-    P1OUT |= bit;
-  } else {
-    P1OUT &= ~bit;
+
+// Take the given 16-bit value and shift it into the chain, LSB to MSB, with
+// a single 16-bit USI transfer. At SCLK = SMCLK the transfer takes 16
+// cycles, so the whole call is a few tens of cycles against ~300 for the
+// bit-banged path. The outputs do not change until latch().
+void shiftData(unsigned int val)
+{
+  oeStop();                                 // Take the USI back from rowEnable()
+  USICKCTL = USIDIV_0 + USISSEL_2;
+  USISR = val;
+  USICNT = USI16B + 16;                     // Start 16-bit transfer
+  while (!(USICTL1 & USIIFG));              // Wait for the last bit
+}
+
+// Shift a whole row into the chain, one 16-bit transfer per panel
+void shiftRow(const volatile unsigned int *row)
+{
+  unsigned char n;
+
+  for (n = 0; n < ROW_WORDS; n++) {
+    shiftData(row[n]);
   }
 }
+#else
+// DATA, CLOCK and LATCH are plain P1 outputs. The USI is left to rowEnable()
+// as an on-time counter, with its pins (USIPEx) off.
+void shiftInit( void )
+{
+  USICTL0 = USIMST + USISWRST;
+  USICKCTL = OE_USICKCTL;
+  USICTL0 &= ~USISWRST;
+}
 
- 
-// Pulse the clock pin
-void pulseClock( void )
+// Put bit n of val on DATA and clock it into the shift register. n must be
+// a constant so the mask folds into an immediate.
+#define SHIFT_BIT(val, n)                                   \
+  do {                                                      \
+    if ((val) & (1u << (n))) P1OUT |= DATA;                 \
+    else                     P1OUT &= ~DATA;                \
+    P1OUT |= CLOCK;                                         \
+    P1OUT &= ~CLOCK;                                        \
+  } while (0)
+
+// Take the given byte and shift it into the chain, LSB to MSB. The outputs
+// do not change until latch().
+//
+// The bits are fully unrolled, the bytes are not. Cycle counts at MCLK =
+// 1 MHz, taken from the MSP430 instruction timings (DATA and CLOCK are
+// constant-generator values, so each bis.b/bic.b on P1OUT costs 4 cycles):
+//
+//                        per bit      per 16 bits
+//   loop + delay(10)     ~10150       ~162500
+//   unrolled, no delay   ~17-18       ~290
+//   unrolled per byte    ~17-18       ~300 (call and loop per byte)
+//
+// The old path is dominated by the 10 x 1000-cycle busy wait per bit; the
+// rest was the variable 1 << i shift and the pinWrite() call. Per row the
+// cost is linear in CHAIN_BYTES.
+void shiftByte(unsigned char val)
 {
-  P1OUT |= CLOCK;
-  delay(10);
-  P1OUT ^= CLOCK;
- 
+  SHIFT_BIT(val, 0);  SHIFT_BIT(val, 1);  SHIFT_BIT(val, 2);  SHIFT_BIT(val, 3);
+  SHIFT_BIT(val, 4);  SHIFT_BIT(val, 5);  SHIFT_BIT(val, 6);  SHIFT_BIT(val, 7);
 }
- 
-// Take the given 16-bit value and shift it out, LSB to MSB
-void shiftOut(unsigned int val)
+
+// Take the given 16-bit value and shift it into the chain, LSB to MSB
+void shiftData(unsigned int val)
 {
-  //Set latch to low (should be already)
-  //P1OUT &= ~LATCH;
- 
-  char i;
- 
-  // Iterate over each bit, set data pin, and pulse the clock to send it
-  // to the shift register
-  for (i = 0; i < 16; i++)  {
-      pinWrite(DATA, (val & (1 << i)));
-      pulseClock();
+  shiftByte(val);
+  shiftByte(val >> 8);
+}
+
+// Shift a whole row into the chain, CHAIN_BYTES bytes in memory order
+// (the MSP430 is little-endian, so that is column 0 first)
+void shiftRow(const volatile unsigned int *row)
+{
+  const volatile unsigned char *p = (const volatile unsigned char *)row;
+  unsigned char n;
+
+  for (n = 0; n < CHAIN_BYTES; n++) {
+    shiftByte(*p++);
   }
- 
-  // Pulse the latch pin to write the values into the storage register
+}
+#endif
+
+// Pulse the latch pin to write the values into the storage register
+void latch( void )
+{
   P1OUT |= LATCH;
   P1OUT &= ~LATCH;
 }
- 
+
 // These functions are just a shortcut to turn on and off the array of
 // LED's when you have the enable pin tied to the MCU. Entirely optional.
 void enable( void )
@@ -276,61 +1331,769 @@ void disable( void )
   P1OUT |= ENABLE;
 }
 
-void setRows(unsigned int row, unsigned int value)
+// Lights the latched row for oeCount[displayBrightness] counts per tick its
+// plane is held: OE goes low now and USI_ISR raises it when the counter runs
+// out, after running it again for each held tick. In the USI build the
+// counter also clocks the '595 shift register, which the next shiftData()
+// overwrites before anything is latched.
+void rowEnable( void )
 {
-	shiftOut(0x0000);	
-	if(row == 0)
-	{
-		P2OUT &= ~(ROW0 + ROW1 + ROW2);
-		
-	}
-	else if(row == 1)
-	{
-		P2OUT &= ~(ROW1 + ROW2);
-		P2OUT |= (ROW0);
-	}
-	else if(row == 2)
-	{
-		P2OUT &= ~(ROW0 + ROW2);
-		P2OUT |= (ROW1);	
-	}
-	else if(row == 3)
-	{
-		P2OUT &= ~(ROW2);
-		P2OUT |= (ROW0 + ROW1);	
-	}
-		else if(row == 4)
-	{
-		P2OUT &= ~(ROW0 + ROW1);
-		P2OUT |= (ROW2);	
-	}
-		else if(row == 5)
-	{
-		P2OUT &= ~(ROW1);
-		P2OUT |= (ROW2 + ROW0);	
-	}
-		else if(row == 6)
-	{
-		P2OUT &= ~(ROW0);
-		P2OUT |= (ROW2 + ROW1);	
-	}
-		else if(row == 7)
+  if (displayBrightness == 0) {
+    return;
+  }
+  enable();
+  if (displayBrightness < BRIGHTNESS_MAX) {
+#ifdef SHIFT_USE_USI
+    USICKCTL = OE_USICKCTL;
+#endif
+#if DISPLAY_PLANES > 1
+    oeRun = oeCount[displayBrightness];
+    oeHold = displayHold;                   // One count per tick it holds
+#endif
+    USICNT = oeCount[displayBrightness];    // Also clears USIIFG
+    USICTL1 |= USIIE;
+  }
+}
+
+// Cancels a running on-time count, so it cannot blank the next row
+void oeStop( void )
+{
+  USICTL1 &= ~USIIE;
+}
+
+// Shows the ROW_WORDS words at data on the given row. The whole chain is
+// shifted in while the previous row is still lit (the '595 outputs only
+// follow the storage register), then OE blanks the outputs just for the row
+// switch and the single latch, so the new data never appears on the old row
+// or the old data on the new one. With brightness below the maximum,
+// rowEnable() shortens the row's on-time.
+//
+// The row is selected with a table lookup and a single masked store, so
+// every row costs the same. Row select cycles at 1 MHz, from the MSP430
+// instruction timings:
+//
+//      row            0   1   2   3   4   5   6   7
+//      if/else       10  17  20  24  27  31  35  35
+//      rowSelect[]   15  15  15  15  15  15  15  15
+//
+// The if/else ladder also wrote P2OUT twice (clear, then set), briefly
+// driving an unrelated row onto the decoder in between.
+//
+// Per row, bit-banged, at 1 MHz:
+//
+//                            shifts   cycles/row   cycles/frame   dark/row
+//      shiftOut(0) blanking    2         ~620         ~4960        ~310
+//      OE blanking             1         ~340         ~2720         ~30
+void setRows(unsigned int row, const volatile unsigned int *data)
+{
+	shiftRow(data);                     // Previous row stays lit meanwhile
+	disable();                          // Blank outputs
+	oeStop();
+	P2OUT = (P2OUT & ~ROW_MASK) | rowSelect[row & (ROWS - 1)];
+	latch();
+	rowEnable();
+}
+
+// Looks up the glyph for c. Lower case maps to upper case and anything
+// outside the table is shown as '?'.
+const unsigned char *fontGlyph(unsigned char c)
+{
+	if (c >= 'a' && c <= 'z')
+		c -= 'a' - 'A';
+	if (c < FONT_FIRST || c > FONT_LAST)
+		c = '?';
+	return font[c - FONT_FIRST];
+}
+
+// Draws c into displayBack with its left edge at column x, replacing what
+// was under the glyph cell. One masked OR per glyph row, two where the cell
+// straddles a panel border; no per-pixel work.
+void drawChar(unsigned char c, unsigned char x)
+{
+	const unsigned char *glyph = fontGlyph(c);
+	volatile unsigned int *word = displayBack + (x >> 4);
+	unsigned char shift = x & 15;
+	unsigned int cell = (1 << FONT_WIDTH) - 1;
+	unsigned int mask = ~(cell << shift);
+	unsigned char row;
+
+	for (row = 0; row < FONT_HEIGHT; row++, word += ROW_WORDS)
 	{
-		P2OUT |= (ROW2 + ROW1 + ROW0);	
+		word[0] = (word[0] & mask) | ((unsigned int)glyph[row] << shift);
+		if (shift > 16 - FONT_WIDTH) {      // Rest goes to the next word
+			word[1] = (word[1] & ~(cell >> (16 - shift))) |
+			          (glyph[row] >> (16 - shift));
+		}
 	}
-	else { }
-	shiftOut(value);
 }
-void print(char c) 
+//------------------------------------------------------------------------------
+// Starts the watchdog as an interval timer driving WDT_ISR
+//------------------------------------------------------------------------------
+void displayInit(void)
+{
+    WDTCTL = DISPLAY_WDT_INTERVAL;          // Interval mode, one row per tick
+    IE1 |= WDTIE;                           // Enable WDT interrupt
+}
+//------------------------------------------------------------------------------
+// Shows displayBack from the next frame on, makes the old front page the new
+// back page and copies the shown frame into it so drawing can continue
+// incrementally. Main loop events run in the frame gap with the scan held,
+// so the swap always lands at a frame boundary.
+//------------------------------------------------------------------------------
+void displayFlip(void)
+{
+    volatile unsigned int *shown = displayBack;
+
+    displayBack = displayFront;
+    displayFront = shown;
+    displaySync();
+}
+//------------------------------------------------------------------------------
+// Copies the frame being shown into displayBack
+//------------------------------------------------------------------------------
+void displaySync(void)
+{
+    unsigned char i;
+
+    for (i = 0; i < PAGE_WORDS; i++) {
+        displayBack[i] = displayFront[i];
+    }
+}
+//------------------------------------------------------------------------------
+// Starts scrolling text (NUL-terminated, must stay valid until stopped) in
+// from the right edge of a blank display. The text repeats with one blank
+// character cell between passes. Only the front page is blanked, in the
+// frame gap: the back page may hold the text.
+//------------------------------------------------------------------------------
+void marqueeStart(const char *text)
+{
+    unsigned char row;
+
+    marqueeStop();
+    animStop();
+    for (row = 0; row < PAGE_WORDS; row++) {
+        displayFront[row] = 0;
+    }
+    marqueePos = 0;
+    marqueeMask = 0x01;
+    marqueeText = text;
+    taskStart(TASK_MARQUEE, MARQUEE_TICKS);
+}
+//------------------------------------------------------------------------------
+// Stops scrolling. The last step stays on the display until the next flip.
+//------------------------------------------------------------------------------
+void marqueeStop(void)
+{
+    taskStop(TASK_MARQUEE);
+    marqueeText = 0;
+}
+//------------------------------------------------------------------------------
+// TASK_MARQUEE: scrolls displayFront one column left and pulls in the next
+// glyph column at the right edge. Runs in the frame gap, so the step lands
+// between two frames. Costs one shift, one AND and one OR per row, with no
+// re-render of the string. Stops itself once marqueeText is cleared.
+//------------------------------------------------------------------------------
+unsigned char marqueeStep(void)
+{
+    const char *text = marqueeText;         // Timer_A1_ISR may clear it
+    const unsigned char *glyph;
+    unsigned char c;
+    unsigned char row;
+
+    if (!text) {
+        return 0;
+    }
+    c = text[marqueePos];
+    glyph = fontGlyph(c ? c : ' ');         // Terminator shows as a gap
+    for (row = 0; row < ROWS; row++) {
+        volatile unsigned int *p = displayFront + row * ROW_WORDS;
+        unsigned int carry = 0;
+        unsigned char w;
+
+        if (row < FONT_HEIGHT && (glyph[row] & marqueeMask)) {
+            carry = 0x8000;                 // Right edge
+        }
+        for (w = ROW_WORDS; w-- > 0; ) {    // Carry across panels
+            unsigned int word = p[w];
+
+            p[w] = (word >> 1) | carry;
+            carry = word << 15;
+        }
+    }
+    marqueeMask <<= 1;                      // Bit 5 is the spacing column
+    if (marqueeMask == 1 << FONT_ADVANCE) {
+        marqueeMask = 0x01;
+        marqueePos = c ? marqueePos + 1 : 0;
+    }
+    return MARQUEE_TICKS;
+}
+//------------------------------------------------------------------------------
+// Plays count frames (ROWS words each, in flash) in a loop, one every period
+// task ticks, starting on the next task tick
+//------------------------------------------------------------------------------
+void animStart(const unsigned int *frames, unsigned char count,
+               unsigned char period)
+{
+    unsigned char row;
+
+    marqueeStop();
+    animStop();
+    for (row = 0; row < PAGE_WORDS; row++) {
+        displayBack[row] = 0;
+    }
+    displayFlip();                          // Both pages blank
+    animFirst = frames;
+    animPos = 0;
+    animCount = count;
+    animPeriod = period;
+    taskStart(TASK_ANIM, 1);                // First frame right away
+}
+//------------------------------------------------------------------------------
+// Stops the animation. Its last frame stays on the display until the next
+// flip.
+//------------------------------------------------------------------------------
+void animStop(void)
+{
+    taskStop(TASK_ANIM);
+}
+//------------------------------------------------------------------------------
+// TASK_ANIM: copies the next animation frame into displayFront. Runs in the
+// frame gap like marqueeStep(), so frames never tear.
+//------------------------------------------------------------------------------
+unsigned char animStep(void)
+{
+    const unsigned int *frame = animFirst + animPos * ROWS;
+    unsigned char row;
+
+    for (row = 0; row < ROWS; row++) {
+        displayFront[row * ROW_WORDS] = *frame++;   // Left panel
+    }
+    if (++animPos == animCount) {
+        animPos = 0;
+    }
+    return animPeriod;
+}
+//------------------------------------------------------------------------------
+// Writes the frame received into displayBack to ANIM_INFO frame number n,
+// erasing its segment first when n is the segment's first frame. The CPU
+// stalls while the flash controller works (up to ~15 ms for an erase), so
+// interrupts are held off and the display is blanked meanwhile, then left
+// lit or dark as the scan had it (the frame gap, a dimmed row). Hosts wait
+// for the ACK, so no character is arriving. Returns PROTO_NAK without
+// writing if frame n is not blank and would not be erased first.
+//------------------------------------------------------------------------------
+unsigned char animStore(unsigned char n)
+{
+    unsigned int *dest = (unsigned int *)(ANIM_INFO_ADDR + n * ROWS);
+    unsigned char dark;
+    unsigned char row;
+
+    if (n % ANIM_SEGMENT_FRAMES != 0) {     // Can't program over old data
+        for (row = 0; row < ROWS; row++) {
+            if (dest[row] != 0xFFFF) {
+                return PROTO_NAK;
+            }
+        }
+    }
+    TimerA_UART_flush();                    // Don't stall a character
+    __disable_interrupt();
+    dark = P1OUT & ENABLE;
+    disable();
+    FCTL2 = FWKEY + FSSEL_1 + FLASH_FN;     // MCLK / (FLASH_FN + 1)
+    FCTL3 = FWKEY;                          // Unlock
+    if (n % ANIM_SEGMENT_FRAMES == 0) {
+        FCTL1 = FWKEY + ERASE;
+        *dest = 0;                          // Dummy write erases segment
+    }
+    FCTL1 = FWKEY + WRT;
+    for (row = 0; row < ROWS; row++) {
+        dest[row] = displayBack[row];
+    }
+    FCTL1 = FWKEY;
+    FCTL3 = FWKEY + LOCK;
+    if (!dark) {
+        enable();
+    }
+    __enable_interrupt();
+    return PROTO_ACK;
+}
+//------------------------------------------------------------------------------
+// Scheduled tasks, indexed by TASK_*
+//------------------------------------------------------------------------------
+unsigned char (* const taskRun[TASKS])(void) = {
+    marqueeStep, animStep, protoTimeout,
+#ifdef TELEMETRY_MS
+    telemetryTick
+#endif
+};
+//------------------------------------------------------------------------------
+// Runs task after first task ticks (1 to 255), then as often as it asks
+//------------------------------------------------------------------------------
+void taskStart(unsigned char task, unsigned char first)
+{
+    taskCount[task] = first;                // Single-byte store starts it
+}
+//------------------------------------------------------------------------------
+// Stops task; it does not run again once this returns
+//------------------------------------------------------------------------------
+void taskStop(unsigned char task)
+{
+    taskCount[task] = 0;
+}
+//------------------------------------------------------------------------------
+// EV_TASKS: one task tick of the frame scheduler, in the frame gap
+//------------------------------------------------------------------------------
+void taskSchedule(void)
+{
+    unsigned char i;
+
+    for (i = 0; i < TASKS; i++) {
+        if (taskCount[i] && --taskCount[i] == 0) {
+            taskCount[i] = taskRun[i]();
+        }
+    }
+}
+//------------------------------------------------------------------------------
+// Display refresh - shows the next row of displayFront on every tick. In the
+// dark frame gap after the last row it hands the CPU to the main loop when
+// an event is pending (page flips, packets, the scheduled tasks), holding
+// the scan until the main loop turns it back on, so a frame never mixes two
+// pages or two scroll positions and no row waits for them. The row is
+// latched at the start of each tick and stays lit until the next one, so
+// every row gets the same on-time. With grayscale each row's planes are
+// shown in turn, each held for as many ticks as its weight. The shift takes
+// several bit times, so interrupts are re-enabled right away to let the
+// UART ISRs in (see the ISR cycle budget); the WDT interrupt itself stays
+// off until the ISR is done so it cannot nest.
+//------------------------------------------------------------------------------
+#pragma vector = WDT_VECTOR
+__interrupt void WDT_ISR(void)
+{
+    static unsigned char row = 0;           // ROWS and up: frame gap
+#if DISPLAY_PLANES > 1
+    static unsigned char plane = 0;         // Bit plane shown, MSB first
+#endif
+#if TASK_FRAMES > 1
+    static unsigned char frames = TASK_FRAMES;  // Frames to the next task tick
+#endif
+    unsigned char handOver = 0;
+
+    IE1 &= ~WDTIE;                          // No re-entry while nested
+    __enable_interrupt();                   // UART ISRs may preempt the rest
+#if DISPLAY_PLANES > 1
+    if (displayHold) {                      // Plane still lit, nothing to shift
+        displayHold--;                      // (USI_ISR chains its on-time)
+    }
+    else
+#endif
+    if (row >= ROWS) {                      // Frame gap, display dark
+        if (row == ROWS) {
+            shiftRow(rowBlank);             // Last row stays lit meanwhile,
+            disable();                      // blanked where a row latches
+            oeStop();
+#if TASK_FRAMES > 1
+            if (--frames == 0) {
+                frames = TASK_FRAMES;
+#endif
+                events |= 1 << EV_TASKS;    // Task tick
+#if TASK_FRAMES > 1
+            }
+#endif
+            handOver = protoReady || events;
+        }
+        if (++row == ROWS + DISPLAY_GAP_TICKS) {
+            row = 0;
+        }
+    }
+    else {
+#if DISPLAY_PLANES > 1
+        displayHold = (1 << (DISPLAY_PLANES - 1 - plane)) - 1;  // Weight 2^k
+        setRows(row, displayFront + (plane * ROWS + row) * ROW_WORDS);
+        if (++plane == DISPLAY_PLANES) {
+            plane = 0;
+            row++;                          // Next row on the next shift
+        }
+#else
+        setRows(row, displayFront + row * ROW_WORDS);
+        row++;                              // Next row on the next shift
+#endif
+    }
+    // Main loop work waits for the gap; a packet finished after the check
+    // waits for the next one. With DISPLAY_LPM3 a UART ISR nested in here
+    // would also lose the SMCLK it needs, since its start bit only reaches
+    // this ISR's stacked SR, and no later tick can make up for that, so
+    // main is woken on every tick to pick LPM3 or LPM0 again.
+#ifdef DISPLAY_LPM3
+    __bic_SR_register_on_exit(LPM3_bits);       // Wake main
+#else
+    if (handOver) {
+        __bic_SR_register_on_exit(LPM3_bits);   // Wake main
+    }
+#endif
+    __disable_interrupt();
+    if (!handOver) {
+        IE1 |= WDTIE;                       // Else main turns it back on
+    }
+}
+//------------------------------------------------------------------------------
+// Brightness - ends the row's on-time started by rowEnable(), or for a
+// plane held over several ticks runs the count again once per held tick
+//------------------------------------------------------------------------------
+#pragma vector = USI_VECTOR
+__interrupt void USI_ISR(void)
+{
+#if DISPLAY_PLANES > 1
+    if (oeHold) {                           // Plane held: next tick's count,
+        oeHold--;                           // OE stays low
+        USICNT = oeRun;
+        return;
+    }
+#endif
+    P1OUT |= ENABLE;                        // disable(), inline: no call saves
+    USICTL1 &= ~USIIE;                      // One-shot
+}
+//------------------------------------------------------------------------------
+// Shows the len characters in textBuf: drawn in place if they fit on the
+// display, scrolled as a marquee otherwise. Text drawn in place is copied
+// out first, as textBuf may be the back page it is drawn into.
+//------------------------------------------------------------------------------
+void showText(unsigned char len)
+{
+    char shown[(COLS + 1) / FONT_ADVANCE];  // Last cell needs no spacing
+    unsigned char row;
+    unsigned char i;
+
+    textBuf[len] = 0;
+    if (len > sizeof shown) {
+        marqueeStart(textBuf);
+        return;
+    }
+    marqueeStop();
+    animStop();
+    for (i = 0; i < len; i++) {
+        shown[i] = textBuf[i];
+    }
+    for (row = 0; row < PAGE_WORDS; row++) {
+        displayBack[row] = 0;
+    }
+    for (i = 0; i < len; i++) {
+        drawChar(shown[i], i * FONT_ADVANCE);
+    }
+    displayFlip();
+}
+//------------------------------------------------------------------------------
+// Adds one byte to a CRC-8 (polynomial 0x07, MSB first), a nibble at a time
+//------------------------------------------------------------------------------
+unsigned char crc8(unsigned char crc, unsigned char byte)
+{
+    crc ^= byte;
+    crc = (crc << 4) ^ crc8Table[crc >> 4];
+    crc = (crc << 4) ^ crc8Table[crc >> 4];
+    return crc;
+}
+//------------------------------------------------------------------------------
+// Display protocol parser, called by Timer_A1_ISR for every received byte
+// while protoReady is 0. Payload bytes go straight to their destination;
+// frame and row data rely on the MSP430 being little-endian. Returns 1 when
+// the packet is finished and protoReady says what the main loop should
+// answer; the parser then ignores input until protoExecute() releases it.
+// Static inline so it is folded into its one caller: an ISR that calls a
+// function saves R12-R15 first (see the RAM table).
+//------------------------------------------------------------------------------
+static inline unsigned char protoByte(unsigned char byte)
+{
+    protoProgress = 1;
+    switch (protoState) {
+        case PROTO_WAIT_SYNC:
+            if (byte == PROTO_SYNC) {
+                protoState = PROTO_WAIT_CMD;
+            }
+            break;
+        case PROTO_WAIT_CMD:
+            protoCmd = byte;
+            protoCrc = crc8(0, byte);
+            protoState = PROTO_WAIT_LEN;
+            break;
+        case PROTO_WAIT_LEN:
+            protoLen = byte;
+            protoPos = 0;
+            protoCrc = crc8(protoCrc, byte);
+            switch (protoCmd) {
+                case PROTO_CMD_FRAME:
+                    if (byte != PAGE_WORDS * 2) {
+                        return protoSkip();
+                    }
+                    marqueeText = 0;        // Stop reading the back page
+                    protoDest = (volatile unsigned char *)displayBack;
+                    break;
+                case PROTO_CMD_ROW:         // Row number first, see below
+                    if (byte != 1 + ROW_WORDS * 2) {
+                        return protoSkip();
+                    }
+                    marqueeText = 0;
+                    protoDest = protoArg;
+                    break;
+                case PROTO_CMD_PLAY:
+                    if (byte != 3) {
+                        return protoSkip();
+                    }
+                    protoDest = protoArg;
+                    break;
+                case PROTO_CMD_BRIGHTNESS:
+                    if (byte != 1) {
+                        return protoSkip();
+                    }
+                    protoDest = protoArg;
+                    break;
+                case PROTO_CMD_STORE:       // Frame number first, see below
+                    if (byte != 1 + ROWS * 2) {
+                        return protoSkip();
+                    }
+                    marqueeText = 0;
+                    protoDest = protoArg;
+                    break;
+                case PROTO_CMD_TEXT:
+                    if (byte == 0 || byte > TEXT_SIZE - 1) {
+                        return protoSkip();
+                    }
+                    marqueeText = 0;
+                    protoDest = (volatile unsigned char *)textBuf;
+                    break;
+                case PROTO_CMD_DELTA:       // Back page holds the front one
+                    if (byte == 0) {
+                        return protoSkip();
+                    }
+                    marqueeText = 0;
+                    protoDest = (volatile unsigned char *)displayBack;
+                    protoRun = 0;
+                    protoState = PROTO_WAIT_DELTA;
+                    return 0;
+                default:
+                    return protoSkip();
+            }
+            protoState = PROTO_WAIT_DATA;
+            break;
+        case PROTO_WAIT_DATA:
+            *protoDest++ = byte;
+            protoCrc = crc8(protoCrc, byte);
+            if (++protoPos == protoLen) {
+                protoState = PROTO_WAIT_CRC;
+            }
+            else if (protoPos == 1) {
+                if (protoCmd == PROTO_CMD_ROW) {
+                    if (protoArg[0] >= DISPLAY_PLANES * ROWS) {
+                        return protoSkip();
+                    }
+                    protoDest = (volatile unsigned char *)
+                                (displayBack + protoArg[0] * ROW_WORDS);
+                }
+                else if (protoCmd == PROTO_CMD_STORE) {
+                    if (protoArg[0] >= ANIM_INFO_FRAMES) {
+                        return protoSkip();
+                    }
+                    protoDest = (volatile unsigned char *)displayBack;
+                }
+            }
+            break;
+        case PROTO_WAIT_DELTA:
+            protoCrc = crc8(protoCrc, byte);
+            if (++protoPos == protoLen) {
+                protoState = PROTO_WAIT_CRC;
+            }
+            if (protoRun) {                 // XOR data
+                if (protoDest == (volatile unsigned char *)(displayBack + PAGE_WORDS)) {
+                    return protoSkip();
+                }
+                *protoDest++ ^= byte;
+                protoRun--;
+            }
+            else if (byte & 0x80) {         // Skip unchanged bytes
+                protoDest += byte - 0x7F;
+                if (protoDest > (volatile unsigned char *)(displayBack + PAGE_WORDS)) {
+                    return protoSkip();
+                }
+            }
+            else {
+                protoRun = byte + 1;
+            }
+            break;
+        case PROTO_WAIT_CRC:
+            return protoDone(byte == protoCrc ? PROTO_ACK : PROTO_NAK);
+        case PROTO_WAIT_SKIP:               // Payload left, then the CRC
+            if (protoPos++ == protoLen) {
+                return protoDone(PROTO_NAK);
+            }
+            break;
+    }
+    return 0;
+}
+//------------------------------------------------------------------------------
+// Rejects the current packet once its length is known: the rest of it, up to
+// protoLen payload bytes and the CRC, is read and dropped before the NAK, so
+// the answer follows the whole packet and none of it is parsed again
+//------------------------------------------------------------------------------
+unsigned char protoSkip(void)
+{
+    protoState = PROTO_WAIT_SKIP;
+    return 0;
+}
+//------------------------------------------------------------------------------
+// Ends the current packet with the given answer and hands it to main
+//------------------------------------------------------------------------------
+unsigned char protoDone(unsigned char answer)
 {
-	buffer[0] = 127;
-  	buffer[1] = 8;
-  	buffer[2] = 8;
-  	buffer[3] = 8;
-  	buffer[4] = 127;
-  	buffer[5] = 0;
-  	buffer[6] = 127;
-  	buffer[7] = 73;
+    protoReady = answer;
+    protoState = PROTO_WAIT_SYNC;
+    return 1;
+}
+//------------------------------------------------------------------------------
+// Carries out the packet Timer_A1_ISR has finished, answers it and lets the
+// parser take the next one. A rejected frame, row or text packet may already
+// have written into displayBack, so the back page is restored from the
+// front. That also keeps the back page equal to the front one for the next
+// delta.
+//------------------------------------------------------------------------------
+void protoExecute(void)
+{
+    unsigned char answer = protoReady;
+
+#ifdef TELEMETRY_MS
+    if (protoTimedOut) {
+        protoTimedOut = 0;
+    }
+    else {                                  // TACCR1 still holds the last bit
+        unsigned int latency = TAR - TACCR1 + uartTbit;
+
+        if (latency > eventLatencyMax) {
+            eventLatencyMax = latency;
+        }
+    }
+#endif
+    if (answer == PROTO_ACK) {
+        switch (protoCmd) {
+            case PROTO_CMD_DELTA:
+                if (protoRun) {             // Packet ended inside a run
+                    answer = PROTO_NAK;
+                    displaySync();
+                    break;
+                }
+                // Fall through
+            case PROTO_CMD_FRAME:
+            case PROTO_CMD_ROW:
+                marqueeStop();
+                animStop();
+                displayFlip();
+                break;
+            case PROTO_CMD_BRIGHTNESS:
+                if (protoArg[0] > BRIGHTNESS_MAX) {
+                    answer = PROTO_NAK;
+                    break;
+                }
+                displayBrightness = protoArg[0];
+                break;
+            case PROTO_CMD_TEXT:
+                showText(protoLen);
+                break;
+            case PROTO_CMD_PLAY:
+                answer = protoPlay();
+                break;
+            case PROTO_CMD_STORE:
+                answer = animStore(protoArg[0]);
+                displaySync();              // Back page held the frame
+                break;
+        }
+    }
+    else if (protoCmd == PROTO_CMD_FRAME || protoCmd == PROTO_CMD_ROW ||
+             protoCmd == PROTO_CMD_DELTA || protoCmd == PROTO_CMD_STORE ||
+             protoCmd == PROTO_CMD_TEXT) {
+        displaySync();
+    }
+    protoReady = 0;                         // Parser may take the next packet
+    TimerA_UART_tx(answer);
+}
+//------------------------------------------------------------------------------
+// Starts the animation a PROTO_CMD_PLAY packet asks for, returns the answer
+//------------------------------------------------------------------------------
+unsigned char protoPlay(void)
+{
+    const unsigned int *frames;
+    unsigned char count;
+
+    switch (protoArg[0]) {
+        case ANIM_BUILTIN:
+            frames = animPing[0];
+            count = sizeof animPing / sizeof animPing[0];
+            break;
+        case ANIM_INFO:
+            frames = ANIM_INFO_ADDR;
+            count = ANIM_INFO_FRAMES;
+            break;
+        default:
+            return PROTO_NAK;
+    }
+    if (protoArg[2] == 0) {
+        return PROTO_NAK;
+    }
+    if (protoArg[1] != 0 && protoArg[1] < count) {
+        count = protoArg[1];
+    }
+    animStart(frames, count, protoArg[2]);
+    return PROTO_ACK;
+}
+//------------------------------------------------------------------------------
+// TASK_PROTO: NAKs a packet that got no byte since the last run, so a lost
+// byte costs one retry instead of desynchronising the parser. protoByte()
+// marks every byte in protoProgress; the parser state alone cannot tell a
+// stall from a stream of packets that happens to be at the same place on
+// every run. A stall found is re-checked and NAKed with interrupts off.
+//------------------------------------------------------------------------------
+unsigned char protoTimeout(void)
+{
+    if (protoProgress) {
+        protoProgress = 0;
+    }
+    else if (protoState != PROTO_WAIT_SYNC) {
+        __disable_interrupt();
+        if (!protoProgress && protoState != PROTO_WAIT_SYNC && !protoReady) {
+            protoDone(PROTO_NAK);
+#ifdef TELEMETRY_MS
+            protoTimedOut = 1;
+#endif
+        }
+        __enable_interrupt();
+    }
+    return PROTO_TIMEOUT_TICKS;
+}
+#ifdef TELEMETRY_MS
+//------------------------------------------------------------------------------
+// TASK_TELEMETRY: asks the main loop for a status packet
+//------------------------------------------------------------------------------
+unsigned char telemetryTick(void)
+{
+    events |= 1 << EV_TELEMETRY;
+    return TELEMETRY_TICKS;
+}
+//------------------------------------------------------------------------------
+// EV_TELEMETRY: sends a PROTO_CMD_STATUS packet, 8 bytes like the TX FIFO
+//------------------------------------------------------------------------------
+void telemetrySend(void)
+{
+    unsigned char status[6];
+    unsigned char crc = 0;
+    unsigned char i;
+
+    status[0] = PROTO_CMD_STATUS;
+    status[1] = 4;
+    status[2] = (unsigned char)rxOverflow;
+    status[3] = rxOverflow >> 8;
+    status[4] = (unsigned char)eventLatencyMax;
+    status[5] = eventLatencyMax >> 8;
+    TimerA_UART_tx(PROTO_SYNC);
+    for (i = 0; i < sizeof status; i++) {
+        TimerA_UART_tx(status[i]);
+        crc = crc8(crc, status[i]);
+    }
+    TimerA_UART_tx(crc);
 }
-//------------------------------------
+#endif
 //------------------------------------------------------------------------------
@@ -0,0 +1,181 @@
+//******************************************************************************
+//  Host stand-in for the MSP430G2231 device header, for test_main.c only.
+//
+//  Registers are plain variables defined by the test, which plays the part
+//  of the hardware around them (captured edges, SCCI, the sleep that lets
+//  WDT_ISR run). Only what main.c touches is here; values match the TI
+//  header. The intrinsics are functions the test implements.
+//
+//  P1OUT, P2OUT, the USI control and counter registers and FCTL1/FCTL3 are
+//  reached through hostPort() and hostFlash(), which let the test see every
+//  pin change, USI transfer and flash write and time them: each access
+//  counts as 4 cycles.
+//******************************************************************************
+#ifndef MSP430G2231_HOST_H
+#define MSP430G2231_HOST_H
+
+#define BIT0                    0x01
+#define BIT1                    0x02
+#define BIT2                    0x04
+#define BIT3                    0x08
+#define BIT4                    0x10
+#define BIT5                    0x20
+#define BIT6                    0x40
+#define BIT7                    0x80
+
+//------------------------------------------------------------------------------
+// Status register bits and interrupt vectors
+//------------------------------------------------------------------------------
+#define GIE                     0x0008
+#define CPUOFF                  0x0010
+#define OSCOFF                  0x0020
+#define SCG0                    0x0040
+#define SCG1                    0x0080
+#define LPM0_bits               (CPUOFF)
+#define LPM3_bits               (SCG1 + SCG0 + CPUOFF)
+#define LPM4_bits               (SCG1 + SCG0 + OSCOFF + CPUOFF)
+
+#define PORT1_VECTOR            4
+#define USI_VECTOR              8
+#define TIMERA1_VECTOR          16
+#define TIMERA0_VECTOR          18
+#define WDT_VECTOR              20
+
+#define __interrupt
+
+void __bis_SR_register(unsigned int bits);
+void __bic_SR_register(unsigned int bits);
+void __bis_SR_register_on_exit(unsigned int bits);
+void __bic_SR_register_on_exit(unsigned int bits);
+unsigned int __even_in_range(unsigned int value, unsigned int range);
+void __delay_cycles(unsigned long cycles);
+void __enable_interrupt(void);
+void __disable_interrupt(void);
+void __no_operation(void);
+
+//------------------------------------------------------------------------------
+// Special function registers
+//------------------------------------------------------------------------------
+extern volatile unsigned char IE1, IFG1;
+#define WDTIE                   0x01
+#define WDTIFG                  0x01
+#define OFIFG                   0x02
+
+//------------------------------------------------------------------------------
+// Watchdog timer
+//------------------------------------------------------------------------------
+extern volatile unsigned int WDTCTL;
+#define WDTIS0                  0x0001
+#define WDTIS1                  0x0002
+#define WDTSSEL                 0x0004
+#define WDTCNTCL                0x0008
+#define WDTTMSEL                0x0010
+#define WDTHOLD                 0x0080
+#define WDTPW                   0x5A00
+#define WDT_MDLY_32             (WDTPW + WDTTMSEL + WDTCNTCL)
+#define WDT_MDLY_8              (WDTPW + WDTTMSEL + WDTCNTCL + WDTIS0)
+#define WDT_MDLY_0_5            (WDTPW + WDTTMSEL + WDTCNTCL + WDTIS1)
+#define WDT_MDLY_0_064          (WDTPW + WDTTMSEL + WDTCNTCL + WDTIS1 + WDTIS0)
+#define WDT_ADLY_1000           (WDTPW + WDTTMSEL + WDTCNTCL + WDTSSEL)
+#define WDT_ADLY_250            (WDTPW + WDTTMSEL + WDTCNTCL + WDTSSEL + WDTIS0)
+#define WDT_ADLY_16             (WDTPW + WDTTMSEL + WDTCNTCL + WDTSSEL + WDTIS1)
+#define WDT_ADLY_1_9            (WDTPW + WDTTMSEL + WDTCNTCL + WDTSSEL + WDTIS1 + WDTIS0)
+
+//------------------------------------------------------------------------------
+// Basic clock module
+//------------------------------------------------------------------------------
+extern volatile unsigned char DCOCTL, BCSCTL1, BCSCTL2, BCSCTL3;
+extern const volatile unsigned char CALBC1_1MHZ, CALDCO_1MHZ;
+#define DIVS_3                  0x06
+#define LFXT1OF                 0x01
+#define XCAP_3                  0x0C
+#define LFXT1S_0                0x00
+#define LFXT1S_2                0x20
+
+//------------------------------------------------------------------------------
+// Digital I/O
+//------------------------------------------------------------------------------
+extern volatile unsigned char P1IN, P1DIR, P1IFG, P1IES, P1IE, P1SEL, P1REN;
+extern volatile unsigned char P2IN, P2DIR, P2IFG, P2IES, P2IE, P2SEL, P2REN;
+extern volatile unsigned char hostP1OUT, hostP2OUT;
+volatile unsigned char *hostPort(volatile unsigned char *reg);
+#define P1OUT                   (*hostPort(&hostP1OUT))
+#define P2OUT                   (*hostPort(&hostP2OUT))
+
+//------------------------------------------------------------------------------
+// USI
+//------------------------------------------------------------------------------
+extern volatile unsigned char USICTL0, USISRL, USISRH;
+extern volatile unsigned char hostUSICTL1, hostUSICKCTL, hostUSICNT;
+extern volatile unsigned int USISR;
+#define USICTL1                 (*hostPort(&hostUSICTL1))
+#define USICKCTL                (*hostPort(&hostUSICKCTL))
+#define USICNT                  (*hostPort(&hostUSICNT))
+#define USISWRST                0x01
+#define USIOE                   0x02
+#define USIGE                   0x04
+#define USIMST                  0x08
+#define USILSB                  0x10
+#define USIPE5                  0x20
+#define USIPE6                  0x40
+#define USIPE7                  0x80
+#define USIIFG                  0x01
+#define USIIE                   0x10
+#define USIIFGCC                0x20
+#define USICKPH                 0x80
+#define USICKPL                 0x02
+#define USISSEL_1               0x04
+#define USISSEL_2               0x08
+#define USIDIV_0                0x00
+#define USIDIV_1                0x20
+#define USIDIV_4                0x80
+#define USIDIV_7                0xE0
+#define USI16B                  0x40
+
+//------------------------------------------------------------------------------
+// Timer_A
+//------------------------------------------------------------------------------
+extern volatile unsigned int TACTL, TAR, TAIV;
+extern volatile unsigned int TACCTL0, TACCR0, TACCTL1, TACCR1;
+#define TAIFG                   0x0001
+#define TAIE                    0x0002
+#define TACLR                   0x0004
+#define MC_1                    0x0010
+#define MC_2                    0x0020
+#define ID_3                    0x00C0
+#define TASSEL_1                0x0100
+#define TASSEL_2                0x0200
+#define CCIFG                   0x0001
+#define COV                     0x0002
+#define OUT                     0x0004
+#define CCI                     0x0008
+#define CCIE                    0x0010
+#define OUTMOD0                 0x0020
+#define OUTMOD1                 0x0040
+#define OUTMOD2                 0x0080
+#define CAP                     0x0100
+#define SCCI                    0x0400
+#define SCS                     0x0800
+#define CM0                     0x4000
+#define CM1                     0x8000
+#define TAIV_TACCR1             2
+#define TAIV_TAIFG              10
+
+//------------------------------------------------------------------------------
+// Flash controller
+//------------------------------------------------------------------------------
+extern volatile unsigned int FCTL2, hostFCTL1, hostFCTL3;
+volatile unsigned int *hostFlash(volatile unsigned int *reg);
+#define FCTL1                   (*hostFlash(&hostFCTL1))
+#define FCTL3                   (*hostFlash(&hostFCTL3))
+#define ERASE                   0x0002
+#define WRT                     0x0040
+#define BUSY                    0x0001
+#define LOCK                    0x0010
+#define FN0                     0x0001
+#define FN1                     0x0002
+#define FSSEL_1                 0x0040
+#define FSSEL_2                 0x0080
+#define FWKEY                   0xA500
+
+#endif
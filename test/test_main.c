@@ -0,0 +1,1698 @@
+//******************************************************************************
+//  Host tests for main.c
+//
+//  main.c is compiled as is against the register stand-ins in msp430g2231.h,
+//  and the test plays the hardware around it: it captures RX edges and
+//  latches SCCI for Timer_A1_ISR, reads the TX line back from the output
+//  modes Timer_A0_ISR sets, runs a WDT_ISR tick whenever main.c sleeps, and
+//  follows the display pins into a model of the '595 chain.
+//  The MSP430's int is 16 bits, so main.c is built with int mapped to short;
+//  words, counter wrap-around and byte order then behave as on the target.
+//
+//  "make -C test" builds and runs it for each configuration in the Makefile.
+//******************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+unsigned short hostInfoMem[3 * 32];         // Info segments D-B, see flashSync()
+#define ANIM_INFO_ADDR          ((const unsigned int *)hostInfoMem)
+
+#define int short                           // 16-bit int, as on the MSP430
+#define main device_main
+#include "../main.c"
+
+//------------------------------------------------------------------------------
+// Registers and intrinsics
+//------------------------------------------------------------------------------
+volatile unsigned char IE1, IFG1;
+volatile unsigned int WDTCTL;
+volatile unsigned char DCOCTL, BCSCTL1, BCSCTL2, BCSCTL3;
+const volatile unsigned char CALBC1_1MHZ = 0x86, CALDCO_1MHZ = 0xB5;
+volatile unsigned char P1IN, P1DIR, P1IFG, P1IES, P1IE, P1SEL, P1REN;
+volatile unsigned char P2IN, P2DIR, P2IFG, P2IES, P2IE, P2SEL, P2REN;
+volatile unsigned char hostP1OUT, hostP2OUT;
+#define USICNT_IDLE             0xFF        // USICNT not written since
+volatile unsigned char USICTL0, USISRL, USISRH;
+volatile unsigned char hostUSICTL1, hostUSICKCTL, hostUSICNT = USICNT_IDLE;
+volatile unsigned int USISR;
+volatile unsigned int TACTL, TAR, TAIV;
+volatile unsigned int TACCTL0, TACCR0, TACCTL1, TACCR1;
+volatile unsigned int FCTL2, hostFCTL1, hostFCTL3 = LOCK;
+
+//------------------------------------------------------------------------------
+// Pins and USI. hostPort() runs before every P1OUT, P2OUT and USI register
+// access and takes in what the access before it did, at that access's time:
+// hostCycles counts 4 cycles per access from the start of the WDT tick it is
+// in, a lower bound on the instruction times. CLOCK and LATCH edges drive a
+// model of the '595 chain, and OE low opens a lit interval that OE high
+// closes; the row select or a latch changing while it is open counts as a
+// glitch.
+//
+// A USICNT write starts the USI counter at SCLK = SMCLK / USIDIVx. With the
+// USI pins on (SHIFT_USE_USI) every count clocks a USISR bit into the chain,
+// LSB first. USIIFG is set when the count runs out, and USI_ISR runs as
+// soon as USIIE and GIE let it.
+//------------------------------------------------------------------------------
+typedef struct {
+    unsigned long start, length;            // Cycles
+    unsigned char row;                      // Row selected
+    unsigned char bits[COLS];               // Latched column bits
+} Lit;
+
+static unsigned long hostCycles;
+static unsigned long hostTicks;
+static unsigned long tickOverruns;          // WDT_ISR still running at the next
+static int hostGie = 1;
+static int inUsiIsr;
+static unsigned long usiDue;                // Count runs out, 0 if stopped
+static unsigned usiErrors;
+static unsigned char p1Seen, p2Seen;
+static unsigned char chainShift[COLS];      // By column, see chainIn()
+static unsigned char chainOut[COLS];        // Storage registers
+static Lit litLog[256];
+static unsigned litLen;
+static Lit litNow;
+static unsigned litGlitches;
+
+// A bit shifted in enters next to the MCU, at the rightmost column, and
+// pushes the others one column left
+static void chainIn(unsigned char bit)
+{
+    memmove(chainShift, chainShift + 1, COLS - 1);
+    chainShift[COLS - 1] = bit;
+}
+
+static unsigned char rowSelected(void)
+{
+    unsigned char r;
+
+    for (r = 0; r < ROWS && rowSelect[r] != (hostP2OUT & ROW_MASK); r++) {
+    }
+    return r;
+}
+
+static void pinSync(void)
+{
+    unsigned char p1 = hostP1OUT;
+    unsigned char rose = p1 & ~p1Seen;
+    int lit = !(p1Seen & ENABLE);
+
+    if (lit && (((hostP2OUT ^ p2Seen) & ROW_MASK) || (rose & LATCH))) {
+        litGlitches++;
+    }
+#ifndef SHIFT_USE_USI
+    if (rose & CLOCK) {
+        chainIn((p1 & DATA) != 0);
+    }
+#endif
+    if (rose & LATCH) {
+        memcpy(chainOut, chainShift, COLS);
+    }
+    if ((p1 ^ p1Seen) & ENABLE) {
+        if (!(p1 & ENABLE)) {
+            litNow.start = hostCycles;
+            litNow.row = rowSelected();
+            memcpy(litNow.bits, chainOut, COLS);
+        }
+        else if (litLen < sizeof litLog / sizeof litLog[0]) {
+            litNow.length = hostCycles - litNow.start;
+            litLog[litLen++] = litNow;
+        }
+    }
+    p1Seen = p1;
+    p2Seen = hostP2OUT;
+}
+
+static void hostSync(void);
+
+static void usiSync(void)
+{
+    if (hostUSICNT != USICNT_IDLE) {
+        unsigned char count = hostUSICNT & 0x1F;
+        unsigned char i;
+
+        if ((hostUSICKCTL & (USISSEL_1 | USISSEL_2)) != USISSEL_2) {
+            usiErrors++;                    // Only SMCLK is modelled
+        }
+        if (USICTL0 & USIPE5) {             // SCLK drives the chain's clock
+            for (i = 0; i < count; i++) {
+                chainIn((USISR >> (i % 16)) & 1);
+            }
+        }
+        hostUSICTL1 &= ~USIIFG;
+        usiDue = hostCycles + ((unsigned long)count << (hostUSICKCTL >> 5));
+        hostUSICNT = USICNT_IDLE;
+    }
+    if (usiDue && hostCycles >= usiDue) {
+        usiDue = 0;
+        hostUSICTL1 |= USIIFG;
+    }
+    if ((hostUSICTL1 & USIIE) && (hostUSICTL1 & USIIFG) && hostGie &&
+        !inUsiIsr) {
+        inUsiIsr = 1;
+        hostGie = 0;
+        USI_ISR();
+        hostSync();
+        hostGie = 1;
+        inUsiIsr = 0;
+    }
+}
+
+static void hostSync(void)
+{
+    pinSync();
+    usiSync();
+}
+
+volatile unsigned char *hostPort(volatile unsigned char *reg)
+{
+    hostSync();
+    hostCycles += 4;
+    return reg;
+}
+
+//------------------------------------------------------------------------------
+// Flash. hostInfoMem stands in for information memory; flashSync() runs on
+// every FCTL1 and FCTL3 access and applies what was written to it since as
+// the flash controller would: a write in erase mode erases its 64-byte
+// segment, one in write mode can only clear bits, and any other write
+// (locked, no mode, a 0 bit made 1) does nothing and counts as an error.
+//------------------------------------------------------------------------------
+#define INFO_WORDS              (sizeof hostInfoMem / sizeof hostInfoMem[0])
+
+static unsigned short flashShadow[INFO_WORDS];
+static unsigned flashErrors;
+
+static void flashSync(void)
+{
+    unsigned i, j;
+
+    for (i = 0; i < INFO_WORDS; i++) {
+        if (hostInfoMem[i] == flashShadow[i]) {
+            continue;
+        }
+        if ((hostFCTL3 & LOCK) || !(hostFCTL1 & (ERASE | WRT))) {
+            flashErrors++;
+            hostInfoMem[i] = flashShadow[i];
+        }
+        else if (hostFCTL1 & ERASE) {
+            for (j = i & ~31u; j < (i & ~31u) + 32; j++) {
+                hostInfoMem[j] = flashShadow[j] = 0xFFFF;
+            }
+        }
+        else {
+            if (hostInfoMem[i] & ~flashShadow[i]) {
+                flashErrors++;
+            }
+            hostInfoMem[i] = flashShadow[i] &= hostInfoMem[i];
+        }
+    }
+}
+
+static void flashErase(void)
+{
+    memset(hostInfoMem, 0xFF, sizeof hostInfoMem);
+    memset(flashShadow, 0xFF, sizeof flashShadow);
+}
+
+volatile unsigned int *hostFlash(volatile unsigned int *reg)
+{
+    flashSync();
+    return reg;
+}
+
+unsigned int srExitCleared;                 // SR bits ISRs cleared on exit
+
+// Sleeping only ends with an interrupt, and the one that always comes is
+// the next scan tick; while WDT_ISR holds the scan for the main loop the
+// tick passes without it
+void __bis_SR_register(unsigned int bits)
+{
+    unsigned long start;
+
+    (void)bits;
+    hostSync();
+    start = ++hostTicks * DISPLAY_TICK_CYCLES;
+    while (usiDue && usiDue <= start) {     // Runs out while main sleeps
+        if (hostCycles < usiDue) {
+            hostCycles = usiDue;
+        }
+        hostSync();
+    }
+    if (hostCycles < start) {
+        hostCycles = start;
+    }
+    if (!(IE1 & WDTIE)) {
+        return;
+    }
+    WDT_ISR();
+    hostSync();
+    if (hostCycles > start + DISPLAY_TICK_CYCLES) {
+        tickOverruns++;
+    }
+    hostGie = 1;                            // Back to main's SR, asleep
+}
+
+void __bic_SR_register(unsigned int bits)
+{
+    (void)bits;
+}
+
+void __bis_SR_register_on_exit(unsigned int bits)
+{
+    (void)bits;
+}
+
+void __bic_SR_register_on_exit(unsigned int bits)
+{
+    srExitCleared |= bits;
+}
+
+unsigned int __even_in_range(unsigned int value, unsigned int range)
+{
+    (void)range;
+    return value;
+}
+
+void __delay_cycles(unsigned long cycles)
+{
+    (void)cycles;
+}
+
+void __enable_interrupt(void)
+{
+    hostGie = 1;
+    hostSync();                             // A pending USI_ISR runs now
+}
+
+void __disable_interrupt(void)
+{
+    hostGie = 0;
+}
+
+void __no_operation(void)
+{
+}
+
+#undef main
+#undef int
+
+#define PAGE_BYTES              (PAGE_WORDS * 2)
+
+//------------------------------------------------------------------------------
+// Checks and a repeatable random source
+//------------------------------------------------------------------------------
+static unsigned long checks;
+static unsigned long failures;
+
+#define CHECK(cond)             check((cond) != 0, #cond, __LINE__)
+
+static void check(int ok, const char *what, int line)
+{
+    checks++;
+    if (!ok && ++failures <= 20) {
+        fprintf(stderr, "test_main.c:%d: CHECK(%s) failed\n", line, what);
+    }
+}
+
+static unsigned long rngState = 0x2545F491;
+
+static unsigned rnd(void)
+{
+    rngState ^= rngState << 13;             // xorshift32
+    rngState &= 0xFFFFFFFFUL;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    rngState &= 0xFFFFFFFFUL;
+    return (unsigned)(rngState >> 8);
+}
+
+//------------------------------------------------------------------------------
+// TX line. txStep() is one CCR0 compare: it runs Timer_A0_ISR, checks the
+// compare time against the Q8 bit time and collects the bit the ISR set up
+// for the next compare, then txLog gets each character with a good frame.
+//------------------------------------------------------------------------------
+static unsigned char txLog[1024];
+static unsigned txLogLen;
+static unsigned txFrameErrors;
+static unsigned txFrame;                    // Bits of the character on the line
+static unsigned txFrameBits;
+static int txActive;
+static unsigned short txStart;              // TACCR0 when the TX started
+static unsigned long txCompares;
+
+static unsigned long tbitQ8(void)
+{
+    return (unsigned long)uartTbit * 256 + uartTbitFrac;
+}
+
+static void txStep(void)
+{
+    long drift;
+
+    if (!txActive) {
+        txActive = 1;
+        txStart = TACCR0;
+        txCompares = 0;
+        txFrameBits = 0;
+    }
+    TAR = TACCR0;
+    Timer_A0_ISR();
+    txCompares++;
+    drift = (long)(unsigned short)(TACCR0 - txStart) * 256
+            - (long)(txCompares * tbitQ8() % 0x1000000UL);  // TAR wraps
+    if (drift >= 0x800000L) {
+        drift -= 0x1000000L;
+    }
+    else if (drift < -0x800000L) {
+        drift += 0x1000000L;
+    }
+    CHECK(drift > -256 && drift < 256);     // Within a cycle of ideal
+    if (!(TACCTL0 & CCIE)) {
+        CHECK(txFrameBits == 0);
+        txActive = 0;
+        return;
+    }
+    txFrame |= (unsigned)!(TACCTL0 & OUTMOD2) << txFrameBits;
+    if (++txFrameBits == 10) {
+        if ((txFrame & 0x001) || !(txFrame & 0x200)) {
+            txFrameErrors++;
+        }
+        else if (txLogLen < sizeof txLog) {
+            txLog[txLogLen++] = (unsigned char)(txFrame >> 1);
+        }
+        txFrame = 0;
+        txFrameBits = 0;
+    }
+}
+
+static void txDrain(void)
+{
+    unsigned long n = 0;
+
+    while ((TACCTL0 & CCIE) && n++ < 100000) {
+        txStep();
+    }
+    CHECK(!(TACCTL0 & CCIE));
+}
+
+//------------------------------------------------------------------------------
+// RX line. rxChar() sends one character from the host at lineTbit (Q8
+// cycles per bit): it captures the start edge and answers each compare with
+// the line level at that time, checking the sample point on the way.
+//------------------------------------------------------------------------------
+static unsigned long now;                   // Line time, cycles
+static unsigned long lineTbit = UART_TBIT_Q8;
+
+static void rxEdge(unsigned long t)
+{
+    TACCR1 = (unsigned short)t;
+    TAIV = TAIV_TACCR1;
+    Timer_A1_ISR();
+}
+
+static void rxChar(unsigned char c)
+{
+    unsigned frame = ((unsigned)c | 0x100) << 1;    // Start 0, stop 1
+    unsigned long tbit15 = (unsigned long)uartTbit15 * 256 + uartTbit15Frac;
+    unsigned long t0 = now;
+    unsigned n = 0;
+
+    CHECK(TACCTL1 & CAP);
+    rxEdge(t0);
+    while (!(TACCTL1 & CAP) && n < 10) {
+        unsigned long dt = (unsigned short)(TACCR1 - (unsigned short)t0);
+        long error = (long)(dt * 256) - (long)(tbit15 + n * tbitQ8());
+        unsigned bit = (unsigned)(dt * 256 / lineTbit);
+
+        CHECK(error > -256 && error <= 0);  // Sample within a cycle
+        if ((frame >> bit) & 1) {
+            TACCTL1 |= SCCI;
+        }
+        else {
+            TACCTL1 &= ~SCCI;
+        }
+        TAIV = TAIV_TACCR1;
+        Timer_A1_ISR();
+        n++;
+    }
+    CHECK(n == 8);
+    now = t0 + (10 * lineTbit + 255) / 256 + 3;     // Stop bit and a gap
+}
+
+//------------------------------------------------------------------------------
+// Packets. Bytes go to protoByte() directly, as Timer_A1_ISR passes them, or
+// over the RX line when viaLine is set.
+//------------------------------------------------------------------------------
+static int viaLine;
+
+static void putByte(unsigned char b)
+{
+    if (viaLine) {
+        rxChar(b);
+    }
+    else if (!protoReady) {                 // Dropped as Timer_A1_ISR does
+        protoByte(b);
+    }
+}
+
+// Sends a packet, with its CRC XORed with crcError; returns protoReady
+static unsigned char sendPacket(unsigned char cmd, unsigned char len,
+                                const unsigned char *payload,
+                                unsigned char crcError)
+{
+    unsigned char crc = crc8(crc8(0, cmd), len);
+    unsigned i;
+
+    putByte(PROTO_SYNC);
+    putByte(cmd);
+    putByte(len);
+    for (i = 0; i < len; i++) {
+        putByte(payload[i]);
+        crc = crc8(crc, payload[i]);
+    }
+    putByte(crc ^ crcError);
+    return protoReady;
+}
+
+// Lets the main loop carry out the finished packet, returns its answer
+static int answer(void)
+{
+    CHECK(protoReady);
+    txLogLen = 0;
+    protoExecute();
+    txDrain();
+    CHECK(txLogLen == 1 && !protoReady && protoState == PROTO_WAIT_SYNC);
+    return txLogLen == 1 ? txLog[0] : -1;
+}
+
+static int transact(unsigned char cmd, unsigned char len,
+                    const unsigned char *payload)
+{
+    sendPacket(cmd, len, payload, 0);
+    return answer();
+}
+
+//------------------------------------------------------------------------------
+// Display pages, plane 0 pixels as the user sees them
+//------------------------------------------------------------------------------
+static void pageBytes(const volatile unsigned short *page, unsigned char *out)
+{
+    unsigned i;
+
+    for (i = 0; i < PAGE_WORDS; i++) {
+        out[2 * i] = (unsigned char)page[i];
+        out[2 * i + 1] = (unsigned char)(page[i] >> 8);
+    }
+}
+
+static int pageIs(const volatile unsigned short *page, const unsigned char *bytes)
+{
+    unsigned char now[PAGE_BYTES];
+
+    pageBytes(page, now);
+    return memcmp(now, bytes, PAGE_BYTES) == 0;
+}
+
+static int pixel(const volatile unsigned short *page, unsigned row, unsigned col)
+{
+    return (page[row * ROW_WORDS + col / 16] >> (col % 16)) & 1;
+}
+
+static int backIsFront(void)
+{
+    unsigned i;
+
+    for (i = 0; i < PAGE_WORDS; i++) {
+        if (displayBack[i] != displayFront[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void reset(void)
+{
+    unsigned i;
+
+    memset((void *)frameBuf, 0, sizeof frameBuf);
+    displayFront = frameBuf[0];
+    displayBack = frameBuf[DISPLAY_PAGES - 1];
+    for (i = 0; i < TASKS; i++) {
+        taskStop(i);
+    }
+    events = 0;
+    IE1 |= WDTIE;
+    marqueeText = 0;
+    displayBrightness = BRIGHTNESS_MAX;
+    protoState = PROTO_WAIT_SYNC;
+    protoReady = 0;
+    TimerA_UART_init();
+    shiftInit();
+    usiDue = 0;
+    hostTicks = hostCycles / DISPLAY_TICK_CYCLES + 1;   // Main ran ahead
+    viaLine = 0;
+    lineTbit = tbitQ8();
+    txLogLen = 0;
+}
+
+//------------------------------------------------------------------------------
+// One pass of main()'s loop, which never returns and so is not run itself:
+// the events pending once WDT_ISR has handed over the frame gap, highest
+// priority first, then the scan back on and a sleep to the next tick
+//------------------------------------------------------------------------------
+static unsigned long packetRunAt;           // hostCycles at EV_PACKET dispatch
+
+static void mainPass(void)
+{
+    unsigned char ready;
+    unsigned char ev;
+
+    while (!(IE1 & WDTIE)) {
+        ready = events;
+        if (protoReady) {
+            ready |= 1 << EV_PACKET;
+        }
+        if (!ready) {
+            IE1 |= WDTIE;
+            break;
+        }
+        for (ev = 0; !(ready & 1); ev++) {
+            ready >>= 1;
+        }
+        events &= ~(1 << ev);
+        if (ev == EV_PACKET) {
+            packetRunAt = hostCycles;
+        }
+        eventRun[ev]();
+    }
+    __bis_SR_register(LPM0_bits);
+}
+
+//------------------------------------------------------------------------------
+// CRC-8: the nibble table against the bitwise definition
+//------------------------------------------------------------------------------
+static unsigned char crc8Bitwise(unsigned char crc, unsigned char byte)
+{
+    unsigned char i;
+
+    crc ^= byte;
+    for (i = 0; i < 8; i++) {
+        crc = (crc & 0x80) ? (unsigned char)((crc << 1) ^ 0x07)
+                           : (unsigned char)(crc << 1);
+    }
+    return crc;
+}
+
+static void testCrc8(void)
+{
+    const char *text = "123456789";
+    unsigned crc, byte;
+    unsigned mismatches = 0;
+    unsigned char c = 0;
+
+    for (crc = 0; crc < 256; crc++) {
+        for (byte = 0; byte < 256; byte++) {
+            if (crc8(crc, byte) != crc8Bitwise(crc, byte)) {
+                mismatches++;
+            }
+        }
+    }
+    CHECK(mismatches == 0);
+    while (*text) {
+        c = crc8(c, *text++);
+    }
+    CHECK(c == 0xF4);                       // CRC-8 check value
+}
+
+//------------------------------------------------------------------------------
+// Frame, row, brightness and text packets
+//------------------------------------------------------------------------------
+static void testFrame(void)
+{
+    unsigned char frame[PAGE_BYTES];
+    unsigned char shown[PAGE_BYTES];
+    unsigned i;
+
+    reset();
+    for (i = 0; i < PAGE_BYTES; i++) {
+        frame[i] = rnd();
+    }
+    CHECK(transact(PROTO_CMD_FRAME, PAGE_BYTES, frame) == PROTO_ACK);
+    CHECK(pageIs(displayFront, frame));
+    CHECK(backIsFront());
+    CHECK(displayFront[0] == (frame[0] | frame[1] << 8));  // Little-endian
+
+    memcpy(shown, frame, sizeof shown);
+    for (i = 0; i < PAGE_BYTES; i++) {
+        frame[i] = rnd();
+    }
+    CHECK(sendPacket(PROTO_CMD_FRAME, PAGE_BYTES, frame, 0x01) == PROTO_NAK);
+    CHECK(answer() == PROTO_NAK);
+    if (DISPLAY_PAGES > 1) {                // One page shows NAKed frames
+        CHECK(pageIs(displayFront, shown));
+    }
+    CHECK(backIsFront());
+
+    CHECK(sendPacket(PROTO_CMD_FRAME, PAGE_BYTES - 1, frame, 0) == PROTO_NAK);
+    CHECK(protoState == PROTO_WAIT_SYNC);   // Read to its end, one answer
+    CHECK(answer() == PROTO_NAK);
+    CHECK(backIsFront());
+
+    putByte(PROTO_SYNC);                    // Unknown command: its payload is
+    putByte(0x7F);                          // skipped, SYNC bytes and all
+    putByte(3);
+    putByte(PROTO_SYNC);
+    putByte(PROTO_CMD_BRIGHTNESS);
+    putByte(1);
+    CHECK(!protoReady && protoState == PROTO_WAIT_SKIP);
+    putByte(0x00);                          // Its CRC
+    CHECK(protoReady == PROTO_NAK);
+    CHECK(answer() == PROTO_NAK);
+    CHECK(transact(PROTO_CMD_FRAME, PAGE_BYTES, shown) == PROTO_ACK);
+
+    CHECK(transact(0x7F, 0, frame) == PROTO_NAK);
+    CHECK(transact(PROTO_CMD_STATUS, 4, frame) == PROTO_NAK);
+}
+
+static void testRow(void)
+{
+    unsigned char frame[PAGE_BYTES] = { 0 };
+    unsigned char row[1 + ROW_WORDS * 2];
+    unsigned r, i;
+
+    reset();
+    for (r = 0; r < DISPLAY_PLANES * ROWS; r++) {
+        row[0] = r;
+        for (i = 1; i < sizeof row; i++) {
+            row[i] = rnd();
+            frame[r * ROW_WORDS * 2 + i - 1] = row[i];
+        }
+        CHECK(transact(PROTO_CMD_ROW, sizeof row, row) == PROTO_ACK);
+        CHECK(pageIs(displayFront, frame));
+    }
+    row[0] = DISPLAY_PLANES * ROWS;
+    CHECK(transact(PROTO_CMD_ROW, sizeof row, row) == PROTO_NAK);
+    CHECK(pageIs(displayFront, frame));
+    CHECK(transact(PROTO_CMD_ROW, sizeof row - 1, row) == PROTO_NAK);
+}
+
+static void testBrightness(void)
+{
+    unsigned char level;
+
+    reset();
+    level = 7;
+    CHECK(transact(PROTO_CMD_BRIGHTNESS, 1, &level) == PROTO_ACK);
+    CHECK(displayBrightness == 7);
+    level = BRIGHTNESS_MAX + 1;
+    CHECK(transact(PROTO_CMD_BRIGHTNESS, 1, &level) == PROTO_NAK);
+    CHECK(displayBrightness == 7);
+    CHECK(transact(PROTO_CMD_BRIGHTNESS, 0, &level) == PROTO_NAK);
+}
+
+//------------------------------------------------------------------------------
+// Row scan, from the pins: over a few frames every row and plane is lit for
+// its weight in ticks, the last row and plane as long as the others, with
+// the row's own data latched, and the frame repeats every
+// DISPLAY_FRAME_TICKS ticks
+//------------------------------------------------------------------------------
+static void testScan(void)
+{
+    unsigned long length[DISPLAY_PLANES] = { 0 };
+    unsigned long frameStart = 0;
+    unsigned i, k, c, first, plane = 0, frames = 0;
+
+    reset();
+    for (i = 0; i < PAGE_WORDS; i++) {
+        displayFront[i] = (unsigned short)(rnd() << 8 | i);  // Rows differ
+    }
+    litLen = 0;
+    litGlitches = 0;
+    for (k = 0; k < 4 * DISPLAY_FRAME_TICKS; k++) {
+        mainPass();
+    }
+    CHECK(litGlitches == 0);
+    for (first = 1; first < litLen &&
+                    !(litLog[first].row == 0 && litLog[first - 1].row != 0);
+         first++) {
+    }
+    CHECK(litLen - first >= 2 * ROWS * DISPLAY_PLANES);
+    for (i = first; i < litLen; i++) {
+        const Lit *l = &litLog[i];
+        const volatile unsigned short *data;
+        unsigned long weight;
+
+        plane = i > first && l->row == litLog[i - 1].row ? plane + 1 : 0;
+        if (l->row >= ROWS || plane >= DISPLAY_PLANES) {
+            CHECK(0);
+            break;
+        }
+        weight = 1UL << (DISPLAY_PLANES - 1 - plane);
+        if (length[plane] == 0) {
+            length[plane] = l->length;
+            CHECK(length[plane] + 32 >= weight * DISPLAY_TICK_CYCLES);
+            CHECK(length[plane] <= weight * DISPLAY_TICK_CYCLES);
+        }
+        CHECK(l->length + 4 >= length[plane] && l->length <= length[plane] + 4);
+        if (l->row == 0 && plane == 0) {
+            if (frames++ > 0) {
+                CHECK(l->start - frameStart == DISPLAY_FRAME_TICKS * DISPLAY_TICK_CYCLES);
+            }
+            frameStart = l->start;
+        }
+        data = displayFront + (plane * ROWS + l->row) * ROW_WORDS;
+        for (c = 0; c < COLS; c++) {
+            CHECK(l->bits[c] == ((data[c / 16] >> (c % 16)) & 1));
+        }
+    }
+    CHECK(frames >= 2);
+    CHECK(tickOverruns == 0);
+}
+
+//------------------------------------------------------------------------------
+// Row shift on its own (bit-banged or USI): the chain holds the row after
+// shiftRow(), the outputs only change on latch(), and the modelled time
+// stays within SHIFT_WORD_CYCLES a word
+//------------------------------------------------------------------------------
+static void testShift(void)
+{
+    unsigned short row[ROW_WORDS];
+    unsigned char before[COLS];
+    unsigned long t;
+    unsigned c, k, bad = 0;
+
+    reset();
+    for (k = 0; k < 50; k++) {
+        for (c = 0; c < ROW_WORDS; c++) {
+            row[c] = rnd();
+        }
+        memcpy(before, chainOut, COLS);
+        hostSync();
+        t = hostCycles;
+        shiftRow(row);
+        hostSync();
+        CHECK(hostCycles - t <= SHIFT_WORD_CYCLES * ROW_WORDS);
+        CHECK(memcmp(chainOut, before, COLS) == 0);
+        latch();
+        hostSync();
+        for (c = 0; c < COLS; c++) {
+            bad += chainOut[c] != ((row[c / 16] >> (c % 16)) & 1);
+        }
+    }
+    CHECK(bad == 0);
+    CHECK(usiErrors == 0);
+}
+
+//------------------------------------------------------------------------------
+// Brightness from the pins: below BRIGHTNESS_MAX every row is lit for its
+// oeCount per tick its plane is held, in one stretch, never cut off by the
+// next USI shift; level / 16 of a tick with the bit-banged chain. Level 0
+// stays dark.
+//------------------------------------------------------------------------------
+static void testDimming(void)
+{
+    unsigned level, i, k;
+
+    reset();
+    for (i = 0; i < PAGE_WORDS; i++) {
+        displayFront[i] = 0xFFFF;
+    }
+    for (level = 0; level < BRIGHTNESS_MAX; level++) {
+        unsigned long want = oeCount[level] * DISPLAY_TICK_CYCLES / 32;
+        unsigned bad = 0;
+
+        CHECK(level == 0 || oeCount[level] > oeCount[level - 1]);
+        CHECK(OE_WINDOW_CYCLES < DISPLAY_TICK_CYCLES
+              || want == level * DISPLAY_TICK_CYCLES / 16);
+        displayBrightness = level;
+        for (k = 0; k < DISPLAY_FRAME_TICKS; k++) {
+            mainPass();
+        }
+        litLen = 0;
+        litGlitches = 0;
+        for (k = 0; k < 2 * DISPLAY_FRAME_TICKS; k++) {
+            mainPass();
+        }
+        CHECK(litGlitches == 0);
+        if (level == 0) {
+            CHECK(litLen == 0 && (hostP1OUT & ENABLE));
+            continue;
+        }
+        CHECK(litLen >= 2 * ROWS * DISPLAY_PLANES - 1);
+        for (i = 0; i < litLen; i++) {
+            unsigned long length = litLog[i].length;
+            unsigned weight = 1;
+
+            while (weight < 1 << (DISPLAY_PLANES - 1)
+                   && length > weight * want + 16) {
+                weight <<= 1;
+            }
+            bad += length < weight * want || length > weight * want + 16;
+        }
+        CHECK(bad == 0);
+    }
+    CHECK(usiErrors == 0);
+}
+
+//------------------------------------------------------------------------------
+// Scheduler, from the scan: a task tick is TASK_FRAMES frames, tasks run in
+// the frame gap with the scan held, a marquee steps every MARQUEE_TICKS task
+// ticks and an animation shows a frame every period, first on the next task
+// tick. The rows lit between two animation frames show the frame, in the
+// left panel.
+//------------------------------------------------------------------------------
+#define TASK_TICK_TICKS         (TASK_FRAMES * DISPLAY_FRAME_TICKS)
+
+static void testTasks(void)
+{
+    static unsigned short frames[3 * ROWS];
+    static const char text[] = "SCROLLING TEXT!";
+    unsigned long tick, last = 0;
+    unsigned i, c, steps = 0, bad = 0;
+    unsigned char pos, mask;
+
+    reset();
+    for (i = 0; i < sizeof frames / sizeof frames[0]; i++) {
+        frames[i] = (unsigned short)(rnd() << 4 | i);   // Frames all differ
+    }
+    animStart(frames, 3, 2);
+    pos = animPos;
+    litLen = 0;
+    litGlitches = 0;
+    for (tick = 1; steps < 5 && tick < 12 * TASK_TICK_TICKS; tick++) {
+        mainPass();
+        if (animPos == pos) {
+            continue;
+        }
+        if (steps++ == 0) {
+            CHECK(tick <= TASK_TICK_TICKS);
+        }
+        else {
+            CHECK(tick - last == 2 * TASK_TICK_TICKS);
+            CHECK(litLen >= ROWS * DISPLAY_PLANES && litLen < 256);
+            for (i = 0; i < litLen; i++) {  // The frame before this step
+                const Lit *l = &litLog[i];
+                unsigned short row = frames[(pos + 2) % 3 * ROWS + l->row];
+                int blank = 1;
+
+                for (c = 0; c < COLS; c++) {
+                    blank &= l->bits[c] == 0;
+                }
+                for (c = 0; c < COLS && !blank; c++) {
+                    bad += l->bits[c] != (c < 16 && ((row >> c) & 1));
+                }
+            }
+        }
+        for (i = 0; i < ROWS; i++) {
+            bad += displayFront[i * ROW_WORDS]
+                   != frames[(animPos + 2) % 3 * ROWS + i];
+        }
+        pos = animPos;
+        last = tick;
+        litLen = 0;
+    }
+    CHECK(steps == 5);
+    CHECK(bad == 0);
+    CHECK(litGlitches == 0);
+    animStop();
+
+    marqueeStart(text);
+    mask = marqueeMask;
+    steps = 0;
+    for (tick = 1; steps < 3 && tick < 4 * MARQUEE_TICKS * TASK_TICK_TICKS;
+         tick++) {
+        mainPass();
+        if (marqueeMask == mask) {
+            continue;
+        }
+        if (steps++ == 0) {
+            CHECK(tick <= MARQUEE_TICKS * TASK_TICK_TICKS);
+        }
+        else {
+            CHECK(tick - last == MARQUEE_TICKS * TASK_TICK_TICKS);
+        }
+        mask = marqueeMask;
+        last = tick;
+    }
+    CHECK(steps == 3);
+    marqueeStop();
+
+    // The gap that hands the task tick over stays dark until the main loop
+    // resumes the scan, and a sleep meanwhile does not run WDT_ISR
+    for (tick = 0; (IE1 & WDTIE) && tick < 2 * TASK_TICK_TICKS; tick++) {
+        __bis_SR_register(LPM0_bits);
+    }
+    CHECK(!(IE1 & WDTIE) && (events & 1 << EV_TASKS) && (hostP1OUT & ENABLE));
+    litLen = 0;
+    __bis_SR_register(LPM0_bits);
+    CHECK(!(IE1 & WDTIE) && litLen == 0);
+    mainPass();
+    CHECK((IE1 & WDTIE) && events == 0);
+    CHECK(tickOverruns == 0);
+}
+
+//------------------------------------------------------------------------------
+// Animation store into the modelled information memory: a segment's first
+// frame erases it, other frames only go onto blank flash, the flash is
+// locked again and OE is left as the scan had it. Stored frames play back.
+//------------------------------------------------------------------------------
+static int storeFrame(unsigned char n, unsigned short *rows)
+{
+    unsigned char payload[1 + ROWS * 2];
+    unsigned i;
+
+    payload[0] = n;
+    for (i = 0; i < ROWS; i++) {
+        rows[i] = (unsigned short)(rnd() << 4 | n);
+        payload[1 + 2 * i] = (unsigned char)rows[i];
+        payload[2 + 2 * i] = rows[i] >> 8;
+    }
+    return transact(PROTO_CMD_STORE, sizeof payload, payload);
+}
+
+static int storedIs(unsigned char n, const unsigned short *rows)
+{
+    unsigned i;
+    int ok = 1;
+
+    for (i = 0; i < ROWS; i++) {
+        ok &= hostInfoMem[n * ROWS + i] == (rows ? rows[i] : 0xFFFF);
+    }
+    return ok;
+}
+
+static void testStore(void)
+{
+    static const unsigned char play[3] = { ANIM_INFO, 2, 1 };
+    unsigned short frame0[ROWS], frame1[ROWS], again[ROWS];
+    unsigned long tick;
+    unsigned i;
+
+    reset();
+    flashErase();
+    flashErrors = 0;
+    CHECK(storeFrame(1, frame1) == PROTO_ACK);  // Onto blank flash
+    CHECK(storedIs(1, frame1) && storedIs(0, 0));
+    CHECK(storeFrame(1, again) == PROTO_NAK);   // Not over old data
+    CHECK(storedIs(1, frame1));
+    CHECK(storeFrame(0, frame0) == PROTO_ACK);  // Erases its segment
+    CHECK(storedIs(0, frame0) && storedIs(1, 0));
+    CHECK(storeFrame(1, frame1) == PROTO_ACK);
+    CHECK(storedIs(1, frame1));
+    CHECK(flashErrors == 0 && (hostFCTL3 & LOCK));
+
+    enable();                               // A lit row stays lit
+    CHECK(animStore(ANIM_SEGMENT_FRAMES) == PROTO_ACK);
+    CHECK(!(hostP1OUT & ENABLE));
+    disable();                              // The frame gap stays dark
+    CHECK(animStore(2 * ANIM_SEGMENT_FRAMES) == PROTO_ACK);
+    CHECK(hostP1OUT & ENABLE);
+    CHECK(flashErrors == 0 && (hostFCTL3 & LOCK));
+
+    CHECK(transact(PROTO_CMD_PLAY, sizeof play, play) == PROTO_ACK);
+    for (tick = 0; animPos == 0 && tick < 2 * TASK_TICK_TICKS; tick++) {
+        mainPass();
+    }
+    for (i = 0; i < ROWS; i++) {
+        CHECK(displayFront[i * ROW_WORDS] == frame0[i]);
+    }
+    for (tick = 0; animPos == 1 && tick < 2 * TASK_TICK_TICKS; tick++) {
+        mainPass();
+    }
+    for (i = 0; i < ROWS; i++) {
+        CHECK(displayFront[i * ROW_WORDS] == frame1[i]);
+    }
+    animStop();
+}
+
+static void testText(void)
+{
+    const char *fits = COLS > 16 ? "Hi! 5" : "Hi";
+    const char *scrolls = "SCROLLING TEXT!";
+    unsigned row, col;
+    unsigned bad = 0;
+
+    reset();
+    CHECK(transact(PROTO_CMD_TEXT, strlen(fits),
+                   (const unsigned char *)fits) == PROTO_ACK);
+    CHECK(marqueeText == 0);
+    for (row = 0; row < ROWS; row++) {
+        for (col = 0; col < COLS; col++) {
+            unsigned i = col / FONT_ADVANCE;
+            unsigned x = col % FONT_ADVANCE;
+            int want = 0;
+
+            if (i < strlen(fits) && x < FONT_WIDTH && row < FONT_HEIGHT) {
+                want = (fontGlyph(fits[i])[row] >> x) & 1;
+            }
+            bad += pixel(displayFront, row, col) != want;
+        }
+    }
+    CHECK(bad == 0);
+    CHECK(fontGlyph('i') == fontGlyph('I'));
+    CHECK(fontGlyph(0x7E) == fontGlyph('?'));
+
+    CHECK(transact(PROTO_CMD_TEXT, strlen(scrolls),
+                   (const unsigned char *)scrolls) == PROTO_ACK);
+    CHECK(marqueeText == textBuf && taskCount[TASK_MARQUEE] != 0);
+    CHECK(strcmp(textBuf, scrolls) == 0);
+    CHECK(sendPacket(PROTO_CMD_TEXT, strlen(scrolls),       // Back page text
+                     (const unsigned char *)scrolls, 0x01) == PROTO_NAK);
+    CHECK(answer() == PROTO_NAK);
+    CHECK(marqueeText == 0 && backIsFront());
+    CHECK(transact(PROTO_CMD_TEXT, 0, 0) == PROTO_NAK);
+    CHECK(transact(PROTO_CMD_TEXT, TEXT_SIZE, (const unsigned char *)
+                   "0123456789ABCDEFG") == PROTO_NAK);
+}
+
+//------------------------------------------------------------------------------
+// Delta decoder, against a reference that applies a payload to a frame the
+// way the protocol describes it. Returns 0 for a payload the device NAKs.
+//------------------------------------------------------------------------------
+static int deltaApply(unsigned char *page, const unsigned char *d, unsigned len)
+{
+    unsigned pos = 0;
+    unsigned i = 0;
+
+    if (len == 0) {
+        return 0;
+    }
+    while (i < len) {
+        unsigned char n = d[i++];
+
+        if (n & 0x80) {
+            pos += n - 0x7F;
+            if (pos > PAGE_BYTES) {
+                return 0;
+            }
+        }
+        else {
+            unsigned run = n + 1u;
+
+            if (run > len - i || pos + run > PAGE_BYTES) {
+                return 0;
+            }
+            while (run--) {
+                page[pos++] ^= d[i++];
+            }
+        }
+    }
+    return 1;
+}
+
+// A random delta payload, valid most of the time
+static unsigned deltaMake(unsigned char *d, unsigned size)
+{
+    unsigned len = 0;
+    unsigned ops = 1 + rnd() % 6;
+
+    while (ops-- && len < size - 1) {
+        if (rnd() & 1) {
+            d[len++] = 0x80 + rnd() % (rnd() % 8 ? 8 : 128);
+        }
+        else {
+            unsigned run = rnd() % (rnd() % 8 ? 4 : 40);
+
+            d[len++] = run;
+            while (run-- && len < size) {
+                d[len++] = rnd();
+            }
+        }
+    }
+    return len;
+}
+
+static void testDelta(void)
+{
+    unsigned char frame[PAGE_BYTES];
+    unsigned char want[PAGE_BYTES];
+    unsigned char d[200];
+    unsigned i, len, valid = 0;
+
+    reset();
+    for (i = 0; i < PAGE_BYTES; i++) {
+        frame[i] = rnd();
+    }
+    CHECK(transact(PROTO_CMD_FRAME, PAGE_BYTES, frame) == PROTO_ACK);
+
+    // Two bytes, skip four, one byte
+    memcpy(want, frame, sizeof want);
+    d[0] = 0x01; d[1] = 0x11; d[2] = 0x22; d[3] = 0x83; d[4] = 0x00; d[5] = 0x33;
+    want[0] ^= 0x11; want[1] ^= 0x22; want[6] ^= 0x33;
+    CHECK(transact(PROTO_CMD_DELTA, 6, d) == PROTO_ACK);
+    CHECK(pageIs(displayFront, want));
+    CHECK(backIsFront());
+
+    // A skip may end right at the end of the frame, not past it
+    d[0] = 0x7F + PAGE_BYTES;
+    CHECK(transact(PROTO_CMD_DELTA, 1, d) == PROTO_ACK);
+    d[0] = 0x80 + PAGE_BYTES;
+    CHECK(transact(PROTO_CMD_DELTA, 1, d) == PROTO_NAK);
+    CHECK(pageIs(displayFront, want));
+
+    // Nor may a run
+    d[0] = 0x7F + PAGE_BYTES; d[1] = 0x00; d[2] = 0xFF;
+    CHECK(transact(PROTO_CMD_DELTA, 3, d) == PROTO_NAK);
+    CHECK(pageIs(displayFront, want));
+
+    // Packet ending inside a run
+    d[0] = 0x03; d[1] = 0xFF; d[2] = 0xFF;
+    CHECK(transact(PROTO_CMD_DELTA, 3, d) == PROTO_NAK);
+    if (DISPLAY_PAGES > 1) {
+        CHECK(pageIs(displayFront, want));
+    }
+    CHECK(backIsFront());
+    CHECK(transact(PROTO_CMD_DELTA, 0, d) == PROTO_NAK);
+
+    // Random deltas
+    for (i = 0; i < 2000; i++) {
+        pageBytes(displayFront, want);
+        len = deltaMake(d, sizeof d);
+        if (deltaApply(want, d, len)) {
+            valid++;
+            CHECK(transact(PROTO_CMD_DELTA, len, d) == PROTO_ACK);
+            CHECK(pageIs(displayFront, want));
+        }
+        else {
+            pageBytes(displayFront, want);
+            CHECK(transact(PROTO_CMD_DELTA, len, d) == PROTO_NAK);
+            if (DISPLAY_PAGES > 1) {
+                CHECK(pageIs(displayFront, want));
+            }
+        }
+        CHECK(backIsFront());
+    }
+    CHECK(valid > 500 && valid < 1900);     // Both kinds were covered
+}
+
+//------------------------------------------------------------------------------
+// Parser fuzz: well-formed packets with now and then a byte lost, and random
+// bytes on an otherwise idle line between them. After every byte the next payload write, and for fixed-length payloads all of
+// the rest, must land inside the buffer it belongs to.
+//------------------------------------------------------------------------------
+static int within(const volatile void *p, unsigned n,
+                  const volatile void *base, unsigned size)
+{
+    const volatile unsigned char *b = base;
+    const volatile unsigned char *q = p;
+
+    return q >= b && q + n <= b + size;
+}
+
+static int parserSafe(void)
+{
+    unsigned rest = protoLen - protoPos;
+    const volatile unsigned char *back = (const volatile unsigned char *)displayBack;
+
+    switch (protoState) {
+        case PROTO_WAIT_DATA:
+            if (protoCmd == PROTO_CMD_TEXT) {
+                return within(protoDest, rest, textBuf, TEXT_SIZE - 1);
+            }
+            if (protoCmd == PROTO_CMD_FRAME) {
+                return within(protoDest, rest, back, PAGE_BYTES);
+            }
+            if (protoCmd == PROTO_CMD_ROW || protoCmd == PROTO_CMD_STORE) {
+                return protoPos == 0 ? within(protoDest, 1, protoArg, 1)
+                                     : within(protoDest, rest, back, PAGE_BYTES);
+            }
+            return within(protoDest, rest, protoArg, sizeof protoArg);
+        case PROTO_WAIT_DELTA:
+            return protoDest >= back && protoDest <= back + PAGE_BYTES;
+        case PROTO_WAIT_SKIP:
+            return protoPos <= protoLen;
+        case PROTO_WAIT_SYNC:
+        case PROTO_WAIT_CMD:
+        case PROTO_WAIT_LEN:
+        case PROTO_WAIT_CRC:
+            return 1;
+    }
+    return 0;
+}
+
+// A well-formed packet with a random command and payload, into p
+static unsigned fuzzPacket(unsigned char *p)
+{
+    static const unsigned char cmds[] = {
+        PROTO_CMD_FRAME, PROTO_CMD_ROW, PROTO_CMD_BRIGHTNESS, PROTO_CMD_TEXT,
+        PROTO_CMD_DELTA, PROTO_CMD_PLAY, PROTO_CMD_STORE
+    };
+    unsigned char cmd = cmds[rnd() % sizeof cmds];
+    unsigned len, i;
+    unsigned char crc;
+
+    switch (cmd) {
+        case PROTO_CMD_FRAME:       len = PAGE_BYTES; break;
+        case PROTO_CMD_ROW:         len = 1 + ROW_WORDS * 2; break;
+        case PROTO_CMD_BRIGHTNESS:  len = 1; break;
+        case PROTO_CMD_TEXT:        len = 1 + rnd() % (TEXT_SIZE - 1); break;
+        case PROTO_CMD_PLAY:        len = 3; break;
+        case PROTO_CMD_STORE:       len = 1 + ROWS * 2; break;
+        default:                    len = deltaMake(p + 3, 100); break;
+    }
+    if (cmd != PROTO_CMD_DELTA) {
+        for (i = 0; i < len; i++) {
+            p[3 + i] = rnd() % 4 ? rnd() % 20 : rnd();     // Mostly in range
+        }
+    }
+    p[0] = PROTO_SYNC;
+    p[1] = cmd;
+    p[2] = len;
+    crc = crc8(crc8(0, cmd), len);
+    for (i = 0; i < len; i++) {
+        crc = crc8(crc, p[3 + i]);
+    }
+    p[3 + len] = crc;
+    return 4 + len;
+}
+
+static void testParserFuzz(void)
+{
+    unsigned char packet[300];
+    unsigned queued = 0, sent = 0;
+    unsigned long n;
+    unsigned unsafe = 0, unsynced = 0, packets = 0, acks = 0;
+
+    reset();
+    for (n = 0; n < 1500000; n++) {
+        unsigned char b;
+
+        if (sent == queued && rnd() % 16 == 0) {
+            queued = fuzzPacket(packet);
+            sent = 0;
+        }
+        if (sent < queued && rnd() % 64) {  // Now and then a byte goes astray
+            b = packet[sent++];
+        }
+        else if (sent == queued && rnd() % 4) {
+            continue;                       // Line idle between packets
+        }
+        else if (rnd() % 4 == 0) {
+            b = PROTO_SYNC;
+        }
+        else {
+            b = rnd();
+        }
+        if (protoByte(b)) {
+            packets++;
+            if (protoReady == PROTO_ACK) {
+                acks++;
+            }
+            if (protoReady == PROTO_ACK &&
+                ((protoCmd == PROTO_CMD_PLAY && protoArg[0] == ANIM_INFO) ||
+                 protoCmd == PROTO_CMD_STORE)) {
+                displaySync();              // No information memory here
+                protoReady = 0;
+            }
+            else {
+                int a = answer();
+
+                CHECK(a == PROTO_ACK || a == PROTO_NAK);
+                if (!backIsFront() && !(DISPLAY_PAGES > 1 && marqueeText)) {
+                    unsynced++;             // Scrolling text is in the back page
+                }
+            }
+        }
+        else if (!parserSafe()) {
+            unsafe++;
+        }
+    }
+    CHECK(unsafe == 0);
+    CHECK(unsynced == 0);
+    CHECK(packets > 10000 && acks > 1000);
+    animStop();
+}
+
+//------------------------------------------------------------------------------
+// Stop-and-wait over the RX line: nothing a waiting host sends is lost, and
+// what arrives while a packet is pending is dropped whole
+//------------------------------------------------------------------------------
+static void testStopAndWait(void)
+{
+    unsigned char a[PAGE_BYTES], b[PAGE_BYTES];
+    unsigned char d[200];
+    unsigned char want[PAGE_BYTES];
+    unsigned short dropped;
+    unsigned i, k, len;
+
+    reset();
+    viaLine = 1;
+    for (i = 0; i < PAGE_BYTES; i++) {
+        a[i] = rnd();
+        b[i] = rnd();
+    }
+    srExitCleared = 0;
+    CHECK(sendPacket(PROTO_CMD_FRAME, PAGE_BYTES, a, 0) == PROTO_ACK);
+    CHECK((srExitCleared & LPM3_bits) == LPM3_bits);     // Main woken
+    dropped = rxOverflow;
+    CHECK(sendPacket(PROTO_CMD_FRAME, PAGE_BYTES, b, 0) == PROTO_ACK);
+    CHECK(protoState == PROTO_WAIT_SYNC);   // Second packet dropped
+    CHECK((unsigned short)(rxOverflow - dropped) == PAGE_BYTES + 4);
+    CHECK(answer() == PROTO_ACK);
+    CHECK(pageIs(displayFront, a));
+    CHECK(sendPacket(PROTO_CMD_FRAME, PAGE_BYTES, b, 0) == PROTO_ACK);
+    CHECK(answer() == PROTO_ACK);
+    CHECK(pageIs(displayFront, b));
+
+    for (k = 0; k < 200; k++) {             // A host that waits each time
+        pageBytes(displayFront, want);
+        do {
+            len = deltaMake(d, sizeof d);
+            memcpy(a, want, sizeof a);
+        } while (!deltaApply(a, d, len));
+        CHECK(transact(PROTO_CMD_DELTA, len, d) == PROTO_ACK);
+        CHECK(pageIs(displayFront, a));
+    }
+
+    // A host streaming at protoTimeout()'s own period: every run finds the
+    // parser at the same place, but bytes came in between
+    viaLine = 0;
+    for (k = 0; k < 20; k++) {
+        unsigned char crc = crc8(crc8(0, PROTO_CMD_FRAME), PAGE_BYTES);
+
+        putByte(PROTO_SYNC);
+        putByte(PROTO_CMD_FRAME);
+        putByte(PAGE_BYTES);
+        protoTimeout();
+        CHECK(!protoReady);
+        for (i = 0; i < PAGE_BYTES; i++) {
+            putByte(a[i]);
+            crc = crc8(crc, a[i]);
+        }
+        putByte(crc);
+        CHECK(answer() == PROTO_ACK);
+    }
+
+    // A lost byte stalls the packet until protoTimeout() NAKs it
+    putByte(PROTO_SYNC);
+    putByte(PROTO_CMD_FRAME);
+    putByte(PAGE_BYTES);
+    putByte(0x12);
+    protoTimeout();
+    CHECK(!protoReady);
+    protoTimeout();
+    CHECK(protoReady == PROTO_NAK);
+    CHECK(answer() == PROTO_NAK);
+    if (DISPLAY_PAGES > 1) {
+        CHECK(pageIs(displayFront, a));
+    }
+}
+
+//------------------------------------------------------------------------------
+// EV_PACKET wakeup-to-dispatch latency, from the scan: packets finish at
+// random points of random ticks while the main loop sleeps, and each is
+// carried out in the next frame gap, no later than a frame and a tick on
+//------------------------------------------------------------------------------
+static unsigned long latencyMin, latencyMax;    // Cycles, for the summary
+
+static void testLatency(void)
+{
+    unsigned char a[PAGE_BYTES];
+    unsigned long done;
+    unsigned i, k, n;
+
+    reset();
+    latencyMin = (unsigned long)-1;
+    latencyMax = 0;
+    for (k = 0; k < 500; k++) {
+        for (n = rnd() % DISPLAY_FRAME_TICKS; n > 0; n--) {
+            mainPass();                     // Asleep at a random tick
+        }
+        while (!(IE1 & WDTIE)) {
+            mainPass();
+        }
+        for (i = 0; i < PAGE_BYTES; i++) {
+            a[i] = rnd();
+        }
+        done = hostTicks * DISPLAY_TICK_CYCLES + rnd() % DISPLAY_TICK_CYCLES;
+        if (done < hostCycles) {            // Not before WDT_ISR is done
+            done = hostCycles;
+        }
+        packetRunAt = 0;
+        CHECK(sendPacket(PROTO_CMD_FRAME, PAGE_BYTES, a, 0) == PROTO_ACK);
+        for (n = 0; !packetRunAt && n < 2 * DISPLAY_FRAME_TICKS; n++) {
+            mainPass();
+        }
+        txDrain();
+        CHECK(packetRunAt > done);
+        CHECK(packetRunAt - done <=
+              (DISPLAY_FRAME_TICKS + 1) * DISPLAY_TICK_CYCLES);
+        CHECK(pageIs(displayFront, a));
+        if (packetRunAt - done < latencyMin) {
+            latencyMin = packetRunAt - done;
+        }
+        if (packetRunAt - done > latencyMax) {
+            latencyMax = packetRunAt - done;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Q8 sample points and line rates the receiver takes
+//------------------------------------------------------------------------------
+static void testRxTiming(void)
+{
+    static const int percent[] = { 0, -3, 3 };
+    unsigned p, c;
+    unsigned bad = 0;
+
+    reset();
+    viaLine = 1;
+    for (p = 0; p < sizeof percent / sizeof percent[0]; p++) {
+        lineTbit = tbitQ8() * (100 + percent[p]) / 100;
+        for (c = 0; c < 256; c++) {
+            rxChar(PROTO_SYNC);
+            rxChar(c);
+            bad += protoState != PROTO_WAIT_LEN || protoCmd != c;
+            protoState = PROTO_WAIT_SYNC;
+        }
+    }
+    CHECK(bad == 0);
+}
+
+//------------------------------------------------------------------------------
+// TX FIFO: every slot usable, nothing lost or reordered across head and
+// tail wrapping, and the Q8 bit timing in txStep()
+//------------------------------------------------------------------------------
+static void testTx(void)
+{
+    unsigned char sent[600];
+    unsigned i, n = 0;
+
+    reset();
+    for (i = 0; i < UART_TX_SIZE; i++) {
+        TimerA_UART_tx(0xC0 + i);
+    }
+    CHECK((unsigned char)(txHead - txTail) == UART_TX_SIZE);
+    txDrain();
+    CHECK(txLogLen == UART_TX_SIZE && txFrameErrors == 0);
+    for (i = 0; i < UART_TX_SIZE; i++) {
+        CHECK(txLog[i] == 0xC0 + i);
+    }
+
+    txLogLen = 0;
+    while (n < sizeof sent) {
+        if ((unsigned char)(txHead - txTail) < UART_TX_SIZE && rnd() % 3) {
+            sent[n] = rnd();
+            TimerA_UART_tx(sent[n++]);
+        }
+        else if (TACCTL0 & CCIE) {
+            txStep();
+        }
+    }
+    txDrain();
+    CHECK(txLogLen == sizeof sent && txFrameErrors == 0);
+    CHECK(memcmp(txLog, sent, sizeof sent) == 0);
+}
+
+//------------------------------------------------------------------------------
+// Glyph cells and marquee steps, against a pixel model, crossing panel
+// borders with more than one panel
+//------------------------------------------------------------------------------
+static void testDrawChar(void)
+{
+    static const char chars[] = "AMW8?";
+    unsigned short before[PAGE_WORDS];
+    unsigned i, x, row, col;
+    unsigned bad = 0;
+
+    reset();
+    for (i = 0; chars[i]; i++) {
+        for (x = 0; x + FONT_WIDTH <= COLS; x++) {
+            const unsigned char *glyph = fontGlyph(chars[i]);
+
+            for (col = 0; col < PAGE_WORDS; col++) {
+                before[col] = displayBack[col] = rnd();
+            }
+            drawChar(chars[i], x);
+            for (row = 0; row < DISPLAY_PLANES * ROWS; row++) {
+                for (col = 0; col < COLS; col++) {
+                    int want = pixel(before, row, col);
+
+                    if (row < FONT_HEIGHT && col >= x && col < x + FONT_WIDTH) {
+                        want = (glyph[row] >> (col - x)) & 1;
+                    }
+                    bad += pixel(displayBack, row, col) != want;
+                }
+            }
+        }
+    }
+    CHECK(bad == 0);
+}
+
+static void testMarquee(void)
+{
+    static const char text[] = "AB";
+    unsigned char model[ROWS][COLS];
+    unsigned step, row, col;
+    unsigned steps = 3 * (sizeof text) * FONT_ADVANCE;
+    unsigned bad = 0;
+
+    reset();
+    for (row = 0; row < PAGE_WORDS; row++) {
+        displayFront[row] = rnd();
+    }
+    for (row = 0; row < ROWS; row++) {
+        for (col = 0; col < COLS; col++) {
+            model[row][col] = pixel(displayFront, row, col);
+        }
+    }
+    marqueeText = text;
+    marqueePos = 0;
+    marqueeMask = 0x01;
+    for (step = 0; step < steps; step++) {
+        unsigned cell = step / FONT_ADVANCE % sizeof text;  // NUL is a gap
+        unsigned x = step % FONT_ADVANCE;
+        const unsigned char *glyph = fontGlyph(text[cell] ? text[cell] : ' ');
+
+        CHECK(marqueeStep() == MARQUEE_TICKS);
+        for (row = 0; row < ROWS; row++) {
+            memmove(model[row], model[row] + 1, COLS - 1);
+            model[row][COLS - 1] = row < FONT_HEIGHT && ((glyph[row] >> x) & 1);
+            for (col = 0; col < COLS; col++) {
+                bad += pixel(displayFront, row, col) != model[row][col];
+            }
+        }
+    }
+    CHECK(bad == 0);
+    marqueeStop();
+    CHECK(marqueeStep() == 0);
+}
+
+#ifdef UART_AUTOBAUD
+//------------------------------------------------------------------------------
+// Autobaud: the five falling edges of a 'U' at tbit (Q8 cycles per bit).
+// Characters follow back to back, as a host UART sends a string of them; a
+// measurement may span two, and a gap between them would count as line time.
+//------------------------------------------------------------------------------
+static void sendU(unsigned long tbit, int glitch)
+{
+    unsigned k;
+
+    for (k = 0; k < 5 && uartAutobaud; k++) {  // The host stops at the lock
+        rxEdge(now + (2 * k * tbit + 128) / 256);
+        if (glitch && k == 1) {
+            rxEdge(now + (3 * tbit + 128) / 256);   // Mid D1
+        }
+    }
+    now += (10 * tbit + 128) / 256;
+}
+
+// Locked within 1.5 cycles over the eight bit times (edges and character
+// starts are rounded to whole cycles), with 1.5 bit times to match
+static int lockedAt(unsigned long tbit)
+{
+    long error = (long)tbitQ8() - (long)tbit;
+
+    return uartAutobaud == 0 && error >= -48 && error <= 48 &&
+           (unsigned long)uartTbit15 * 256 + uartTbit15Frac == tbitQ8() * 3 / 2;
+}
+
+static void testAutobaud(void)
+{
+    unsigned long tbit4800 = (SMCLK_FREQ * 256UL + 2400) / 4800;
+    unsigned long tbit2400 = (SMCLK_FREQ * 256UL + 1200) / 2400;
+    unsigned long tbitMin = UART_TBIT_MIN * 256UL + 128;    // Fastest served
+    unsigned long tbitFast = (UART_TBIT_MIN - 1) * 256UL;   // One cycle less
+
+    reset();
+    TimerA_UART_autobaud();
+    srExitCleared = 0;
+    sendU(tbit4800, 0);
+    CHECK(lockedAt(tbit4800));
+    CHECK(srExitCleared & LPM0_bits);       // Wakes main
+    viaLine = 1;
+    lineTbit = tbit4800;
+    rxChar(PROTO_SYNC);
+    rxChar('X');
+    CHECK(protoState == PROTO_WAIT_LEN && protoCmd == 'X');
+    protoState = PROTO_WAIT_SYNC;
+    TimerA_UART_tx('Y');
+    txDrain();
+    CHECK(txLogLen == 1 && txLog[0] == 'Y');
+
+    TimerA_UART_autobaud();                 // Glitch: restarts, next 'U' locks
+    sendU(tbit2400, 1);
+    CHECK(uartAutobaud != 0);
+    sendU(tbit2400, 0);
+    CHECK(lockedAt(tbit2400));
+
+    TimerA_UART_autobaud();                 // Just fast enough
+    sendU(tbitMin, 0);
+    CHECK(lockedAt(tbitMin));
+
+    TimerA_UART_autobaud();                 // Too fast to serve
+    sendU(tbitFast, 0);
+    CHECK(uartAutobaud != 0);
+    now += 5000;
+    sendU(tbit2400, 0);
+    sendU(tbit2400, 0);
+    CHECK(lockedAt(tbit2400));
+}
+#endif
+
+int main(void)
+{
+    testCrc8();
+    testFrame();
+    testRow();
+    testBrightness();
+    testScan();
+    testShift();
+    testDimming();
+    testTasks();
+    testStore();
+    testText();
+    testDelta();
+    testParserFuzz();
+    testStopAndWait();
+    testLatency();
+    testRxTiming();
+    testTx();
+    testDrawChar();
+    testMarquee();
+#ifdef UART_AUTOBAUD
+    testAutobaud();
+#endif
+    printf("%lu checks, %lu failed (%lu MHz, %lu baud, PANELS %d, "
+           "DISPLAY_PLANES %d%s%s)\n", checks, failures,
+           SMCLK_FREQ / 1000000UL, (unsigned long)UART_BAUD, PANELS, DISPLAY_PLANES,
+#ifdef SHIFT_USE_USI
+           ", SHIFT_USE_USI",
+#else
+           "",
+#endif
+#ifdef UART_AUTOBAUD
+           ", UART_AUTOBAUD"
+#else
+           ""
+#endif
+           );
+    printf("EV_PACKET latency %lu to %lu cycles, frame %lu\n",
+           latencyMin, latencyMax,
+           (unsigned long)DISPLAY_FRAME_TICKS * DISPLAY_TICK_CYCLES);
+    return failures != 0;
+}